@@ -0,0 +1,300 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <fcntl.h>
+#include <time.h>
+
+#ifndef BENCH_REVISION
+# define BENCH_REVISION "unknown"
+#endif
+
+#define BENCH_ROUNDS    5
+#define BENCH_UNIFORM   (8UL << 20)
+#define BENCH_WEIGHTED  (8UL << 20)
+#define BENCH_BANKS     64
+
+struct bench_corpus {
+    const char *name;
+    uint8_t *data;
+    size_t size;
+};
+
+struct bench_result {
+    double best;
+    double median;
+    size_t insns;
+};
+
+static uint64_t bench_seed;
+
+/* xorshift64*, fixed seed so every run sees the same corpus */
+static uint64_t bench_rand(void)
+{
+    bench_seed ^= bench_seed >> 12;
+    bench_seed ^= bench_seed << 25;
+    bench_seed ^= bench_seed >> 27;
+    return bench_seed * 0x2545f4914f6cdd1dULL;
+}
+
+static double bench_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *bench_alloc(size_t size)
+{
+    uint8_t *data;
+
+    if (!(data = malloc(size)))
+        err(-1, "corpus alloc err");
+
+    return data;
+}
+
+static void corpus_uniform(struct bench_corpus *corpus)
+{
+    size_t index;
+
+    bench_seed = 0x6d637335312d6231ULL;
+    corpus->name = "uniform";
+    corpus->size = BENCH_UNIFORM;
+    corpus->data = bench_alloc(corpus->size);
+
+    for (index = 0; index < corpus->size; ++index)
+        corpus->data[index] = bench_rand();
+}
+
+/*
+ * Opcodes grouped by operand format, so a stream can pick formats
+ * evenly and exercise every case of the formatter.
+ */
+struct bench_formats {
+    uint8_t opcodes[MCS51_INS_PTL + 1][256];
+    unsigned int count[MCS51_INS_PTL + 1];
+    unsigned int used[MCS51_INS_PTL + 1];
+    unsigned int nr_used;
+};
+
+static void bench_formats_init(struct bench_formats *fmts)
+{
+    struct mcs51_insn insn;
+    unsigned int opcode, format;
+    uint8_t buf[MCS51_INSN_MAX] = { };
+
+    memset(fmts, 0, sizeof(*fmts));
+    for (opcode = 0; opcode < 256; ++opcode) {
+        buf[0] = opcode;
+        mcs51_decode(&insn, buf, sizeof(buf), 0);
+        if (!insn.ops)
+            continue;
+        format = insn.ops->format;
+        if (!fmts->count[format])
+            fmts->used[fmts->nr_used++] = format;
+        fmts->opcodes[format][fmts->count[format]++] = opcode;
+    }
+}
+
+static size_t bench_emit_insn(uint8_t *buf, uint8_t opcode)
+{
+    buf[0] = opcode;
+    buf[1] = bench_rand();
+    buf[2] = bench_rand();
+
+    return mcs51_insn_size(buf, MCS51_INSN_MAX);
+}
+
+static void corpus_weighted(struct bench_corpus *corpus, const struct bench_formats *fmts)
+{
+    unsigned int format;
+    size_t offset;
+
+    bench_seed = 0x6d637335312d6232ULL;
+    corpus->name = "weighted";
+    corpus->size = BENCH_WEIGHTED;
+    corpus->data = bench_alloc(corpus->size + MCS51_INSN_MAX);
+
+    for (offset = 0; offset < corpus->size;) {
+        format = fmts->used[bench_rand() % fmts->nr_used];
+        offset += bench_emit_insn(corpus->data + offset,
+            fmts->opcodes[format][bench_rand() % fmts->count[format]]);
+    }
+}
+
+/* Opcode mix loosely following compiled 8051 code */
+static const uint8_t bench_common[] = {
+    0x74, 0xe5, 0xf5, 0x75, 0x90, 0xe0, 0xf0, 0xa3, 0x12, 0x12, 0x22, 0x60,
+    0x70, 0x80, 0xe4, 0xc2, 0xd2, 0x24, 0x34, 0xc3, 0x94, 0xe8, 0xf8, 0xe6,
+    0xf6, 0x08, 0x18, 0xb4, 0xd8, 0x20, 0x30, 0x02, 0x93, 0x83, 0xc0, 0xd0,
+};
+
+static void corpus_realistic(struct bench_corpus *corpus)
+{
+    size_t bank, offset, end, size;
+    uint8_t *data;
+
+    bench_seed = 0x6d637335312d6233ULL;
+    corpus->name = "realistic";
+    corpus->size = BENCH_BANKS << 16;
+    corpus->data = bench_alloc(corpus->size + MCS51_INSN_MAX);
+    memset(corpus->data, 0xff, corpus->size);
+
+    for (bank = 0; bank < BENCH_BANKS; ++bank) {
+        data = corpus->data + (bank << 16);
+
+        /* reset vector, then the interrupt vectors at 0x03 + 8n */
+        for (offset = 0; offset < 0x30; offset = offset ? offset + 8 : 0x03) {
+            data[offset] = 0x02;
+            data[offset + 1] = 0x01;
+            data[offset + 2] = offset;
+        }
+
+        /* code blocks separated by lookup tables and strings */
+        for (offset = 0x100; offset < 0xc000;) {
+            for (end = offset + 256 + bench_rand() % 2048; offset < end;)
+                offset += bench_emit_insn(data + offset,
+                    bench_common[bench_rand() % ARRAY_SIZE(bench_common)]);
+
+            for (size = bench_rand() % 256; size--; ++offset)
+                data[offset] = bench_rand() & 0x7f;
+        }
+
+        /* the top of each bank stays erased flash */
+    }
+}
+
+static int bench_cmp(const void *pa, const void *pb)
+{
+    double a = *(const double *)pa, b = *(const double *)pb;
+    return a < b ? -1 : a > b;
+}
+
+static void bench_finish(struct bench_result *result, double *times, size_t insns)
+{
+    qsort(times, BENCH_ROUNDS, sizeof(*times), bench_cmp);
+    result->best = times[0];
+    result->median = times[BENCH_ROUNDS / 2];
+    result->insns = insns;
+}
+
+static void bench_decode(struct bench_result *result, const struct bench_corpus *corpus)
+{
+    struct mcs51_insn insn;
+    double times[BENCH_ROUNDS], start;
+    size_t offset, insns = 0;
+    unsigned int round;
+    volatile uint32_t sink = 0;
+
+    for (round = 0; round < BENCH_ROUNDS; ++round) {
+        start = bench_clock();
+        for (offset = 0, insns = 0; offset < corpus->size; offset += insn.size, ++insns) {
+            mcs51_decode(&insn, corpus->data + offset, corpus->size - offset, offset);
+            sink += insn.target;
+        }
+        times[round] = bench_clock() - start;
+    }
+
+    bench_finish(result, times, insns);
+}
+
+static void bench_format(struct bench_result *result, const struct bench_corpus *corpus)
+{
+    struct mcs51_insn insn;
+    double times[BENCH_ROUNDS], start;
+    char line[MCS51_LINE_MAX];
+    size_t offset, insns = 0;
+    unsigned int round;
+    volatile size_t sink = 0;
+
+    for (round = 0; round < BENCH_ROUNDS; ++round) {
+        start = bench_clock();
+        for (offset = 0, insns = 0; offset < corpus->size; offset += insn.size, ++insns) {
+            mcs51_decode(&insn, corpus->data + offset, corpus->size - offset, offset);
+            sink += mcs51_format_insn(line, &insn, NULL);
+        }
+        times[round] = bench_clock() - start;
+    }
+
+    bench_finish(result, times, insns);
+}
+
+static void bench_output(struct bench_result *result, const struct bench_corpus *corpus)
+{
+    struct mcs51_emit emit;
+    char path[] = "/tmp/mcs51-bench-XXXXXX";
+    double times[BENCH_ROUNDS], start;
+    size_t offset, insns;
+    unsigned int round;
+    int fd;
+
+    if ((fd = mkstemp(path)) < 0)
+        err(-1, "Cannot create bench output");
+    unlink(path);
+
+    for (round = 0; round < BENCH_ROUNDS; ++round) {
+        if (ftruncate(fd, 0) || lseek(fd, 0, SEEK_SET))
+            err(-1, "bench output truncate err");
+
+        start = bench_clock();
+        mcs51_emit_init(&emit, fd, MCS51_EMIT_SIZE);
+        mcs51_emit_range(&emit, corpus->data, corpus->size, 0, corpus->size, 0);
+        mcs51_emit_exit(&emit);
+        times[round] = bench_clock() - start;
+    }
+
+    for (offset = 0, insns = 0; offset < corpus->size; ++insns)
+        offset += mcs51_insn_size(corpus->data + offset, corpus->size - offset);
+
+    close(fd);
+    bench_finish(result, times, insns);
+}
+
+static void bench_report(const struct bench_corpus *corpus, const char *phase,
+                         const struct bench_result *result, bool last)
+{
+    printf("    {\"corpus\": \"%s\", \"phase\": \"%s\", \"bytes\": %zu, "
+           "\"insns\": %zu, \"rounds\": %u, \"best_s\": %.6f, \"median_s\": %.6f, "
+           "\"mb_per_s\": %.2f, \"ns_per_insn\": %.2f}%s\n",
+           corpus->name, phase, corpus->size, result->insns, BENCH_ROUNDS,
+           result->best, result->median, corpus->size / result->median / 1e6,
+           result->median * 1e9 / result->insns, last ? "" : ",");
+}
+
+int main(void)
+{
+    static struct bench_formats fmts;
+    struct bench_corpus corpus[3];
+    struct bench_result result;
+    unsigned int index;
+
+    bench_formats_init(&fmts);
+    corpus_uniform(&corpus[0]);
+    corpus_weighted(&corpus[1], &fmts);
+    corpus_realistic(&corpus[2]);
+
+    printf("{\n  \"revision\": \"%s\",\n  \"compiler\": \"%s\",\n"
+           "  \"formats\": %u,\n  \"results\": [\n",
+           BENCH_REVISION, __VERSION__, fmts.nr_used);
+
+    for (index = 0; index < ARRAY_SIZE(corpus); ++index) {
+        bench_decode(&result, &corpus[index]);
+        bench_report(&corpus[index], "decode", &result, false);
+        bench_format(&result, &corpus[index]);
+        bench_report(&corpus[index], "format", &result, false);
+        bench_output(&result, &corpus[index]);
+        bench_report(&corpus[index], "output", &result,
+                     index == ARRAY_SIZE(corpus) - 1);
+        free(corpus[index].data);
+    }
+
+    printf("  ]\n}\n");
+    return 0;
+}
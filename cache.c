@@ -0,0 +1,377 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC     "MCS51C\0\1"
+#define CACHE_SLOTS     (1UL << 16)
+#define CACHE_PROBES    16
+#define CACHE_BLOCK     4096
+
+/* Bytes past the end of a block the last instruction may read */
+#define CACHE_TAIL      (MCS51_INSN_MAX - 1)
+
+
+/*
+ * The index is a fixed open-addressed table mapped by every user.
+ * Rendered blocks are appended to a separate blob file. Writers take
+ * an exclusive flock on the index, readers take no lock at all: a slot
+ * is published by storing its key last, and every blob is checked
+ * against the checksum in its slot before use, so a torn or recycled
+ * entry reads as a miss.
+ */
+struct cache_head {
+    char magic[8];
+    uint64_t fingerprint;
+    uint64_t slots;
+};
+
+struct mcs51_cache_slot {
+    uint64_t key[2];
+    uint64_t offset;
+    uint32_t len;
+    uint32_t check;
+    uint32_t exit;
+    uint32_t pad;
+};
+
+#define CACHE_INDEX_SIZE (sizeof(struct cache_head) + \
+                          CACHE_SLOTS * sizeof(struct mcs51_cache_slot))
+
+/*
+ * Output of one block never exceeds this: every record reserves the
+ * worst case of its format, see mcs51_emit_insn and its backends.
+ */
+static inline size_t cache_render(enum mcs51_output output)
+{
+    switch (output) {
+        case MCS51_OUTPUT_JSON:
+            return CACHE_BLOCK * MCS51_JSON_MAX;
+
+        case MCS51_OUTPUT_BIN:
+            return CACHE_BLOCK * sizeof(struct mcs51_record);
+
+        default:
+            return CACHE_BLOCK * (MCS51_LINE_MAX + 32);
+    }
+}
+
+static inline uint64_t cache_mix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+/* Word-at-a-time multiplicative hash, not for adversarial input */
+static uint64_t cache_hash(const void *data, size_t size, uint64_t seed)
+{
+    const uint8_t *walk = data;
+    uint64_t hash, word;
+
+    hash = seed ^ (size * 0x9e3779b97f4a7c15ULL);
+    for (; size >= 8; size -= 8, walk += 8) {
+        memcpy(&word, walk, 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 29;
+    }
+
+    word = 0;
+    memcpy(&word, walk, size);
+    return cache_mix(hash ^ word);
+}
+
+/*
+ * A digest of what the decoder and every output backend currently
+ * produce, so that entries rendered by another build are never served.
+ * Every opcode is rendered with two operand patterns at a 16-bit and a
+ * 24-bit address, as text, JSON and records, with and without symbol
+ * names and labels, through the same mcs51_emit_insn the sweep uses.
+ */
+static uint64_t cache_fingerprint(void)
+{
+    static const uint8_t operands[][2] = { {0x5a, 0xa5}, {0xff, 0x00} };
+    static const uint32_t addrs[] = { 0x1234, 0x123456 };
+    struct mcs51_symbols *sym;
+    struct mcs51_emit emit;
+    struct mcs51_insn insn;
+    uint8_t data[MCS51_INSN_MAX] = { };
+    unsigned int opcode, index, addr, named;
+    enum mcs51_output output;
+    uint64_t hash;
+
+    if (!(sym = calloc(1, sizeof(*sym))))
+        err(-1, "cache fingerprint alloc err");
+    mcs51_symbols_builtin(sym, "8052");
+    mcs51_emit_init(&emit, -1, MCS51_EMIT_SIZE);
+
+    for (output = MCS51_OUTPUT_TEXT; output <= MCS51_OUTPUT_BIN; ++output) {
+        emit.output = output;
+        mcs51_emit_begin(&emit);
+
+        for (named = 0; named < 2; ++named) {
+            emit.sym = named ? sym : NULL;
+            for (opcode = 0; opcode < 256; ++opcode) {
+                for (index = 0; index < ARRAY_SIZE(operands); ++index) {
+                    for (addr = 0; addr < ARRAY_SIZE(addrs); ++addr) {
+                        data[0] = opcode;
+                        data[1] = operands[index][0];
+                        data[2] = operands[index][1];
+                        mcs51_decode(&insn, data, sizeof(data), addrs[addr]);
+                        if (named)
+                            insn.flags |= MCS51_INSN_LABEL | MCS51_INSN_SYMBOLIC;
+                        mcs51_emit_insn(&emit, &insn);
+                    }
+                }
+            }
+        }
+    }
+
+    hash = cache_hash(emit.buf, emit.len, 0);
+    mcs51_emit_exit(&emit);
+    free(sym);
+    return hash;
+}
+
+static void cache_reset(struct mcs51_cache *cache)
+{
+    struct cache_head *head = cache->index;
+
+    memset(head, 0, CACHE_INDEX_SIZE);
+    memcpy(head->magic, CACHE_MAGIC, sizeof(head->magic));
+    head->fingerprint = cache->fingerprint;
+    head->slots = CACHE_SLOTS;
+}
+
+/**
+ * mcs51_cache_open - open or create a disassembly cache.
+ * @cache: cache to set up.
+ * @path: directory holding the cache, created when missing.
+ * @sym: symbols the listing is rendered with, NULL for none.
+ *
+ * A cache written by a decoder that renders differently is emptied,
+ * entries are also keyed by the selected core. Returns 0 or a negative
+ * error number.
+ */
+int mcs51_cache_open(struct mcs51_cache *cache, const char *path,
+                     const struct mcs51_symbols *sym)
+{
+    const struct cache_head *head;
+    struct stat stat;
+    char name[4096];
+    int retval;
+
+    memset(cache, 0, sizeof(*cache));
+    cache->index_fd = cache->blob_fd = -1;
+    cache->fingerprint = cache_fingerprint();
+    cache->seed = cache_hash(mcs51_variant_name(), strlen(mcs51_variant_name()),
+                             cache->fingerprint);
+    if (sym)
+        cache->seed = cache_hash(sym, sizeof(*sym), cache->seed);
+    pthread_mutex_init(&cache->lock, NULL);
+
+    if (mkdir(path, 0755) && errno != EEXIST)
+        return -errno;
+
+    snprintf(name, sizeof(name), "%s/index", path);
+    if ((cache->index_fd = open(name, O_RDWR | O_CREAT, 0644)) < 0)
+        goto failed;
+
+    snprintf(name, sizeof(name), "%s/blobs", path);
+    if ((cache->blob_fd = open(name, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0)
+        goto failed;
+
+    if (flock(cache->index_fd, LOCK_EX) || fstat(cache->index_fd, &stat))
+        goto failed;
+
+    if (stat.st_size != CACHE_INDEX_SIZE && ftruncate(cache->index_fd, CACHE_INDEX_SIZE))
+        goto failed;
+
+    cache->index = mmap(NULL, CACHE_INDEX_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, cache->index_fd, 0);
+    if (cache->index == MAP_FAILED) {
+        cache->index = NULL;
+        goto failed;
+    }
+
+    head = cache->index;
+    if (memcmp(head->magic, CACHE_MAGIC, sizeof(head->magic)) ||
+        head->fingerprint != cache->fingerprint || head->slots != CACHE_SLOTS) {
+        if (ftruncate(cache->blob_fd, 0))
+            goto failed;
+        cache_reset(cache);
+    }
+
+    flock(cache->index_fd, LOCK_UN);
+    cache->slots = (struct mcs51_cache_slot *)((struct cache_head *)cache->index + 1);
+    return 0;
+
+failed:
+    retval = -errno;
+    mcs51_cache_close(cache);
+    return retval;
+}
+
+void mcs51_cache_close(struct mcs51_cache *cache)
+{
+    if (cache->index)
+        munmap(cache->index, CACHE_INDEX_SIZE);
+    if (cache->index_fd >= 0)
+        close(cache->index_fd);
+    if (cache->blob_fd >= 0)
+        close(cache->blob_fd);
+
+    pthread_mutex_destroy(&cache->lock);
+    cache->index = NULL;
+    cache->index_fd = cache->blob_fd = -1;
+}
+
+/* Copy a cached block into @emit, returns false on a miss */
+static bool cache_lookup(struct mcs51_cache *cache, struct mcs51_emit *emit,
+                         const uint64_t *key, unsigned int *exit)
+{
+    struct mcs51_cache_slot *slot;
+    unsigned int probe;
+    uint64_t offset;
+    uint32_t len;
+    char *buf;
+
+    for (probe = 0; probe < CACHE_PROBES; ++probe) {
+        slot = &cache->slots[(key[0] + probe) % CACHE_SLOTS];
+        if (!__atomic_load_n(&slot->key[0], __ATOMIC_ACQUIRE))
+            return false;
+        if (slot->key[0] != key[0] || slot->key[1] != key[1])
+            continue;
+
+        offset = slot->offset;
+        len = slot->len;
+        *exit = slot->exit;
+        if (len > cache_render(emit->output) || *exit > CACHE_TAIL)
+            return false;
+
+        buf = mcs51_emit_reserve(emit, len);
+        if (pread(cache->blob_fd, buf, len, offset) != (ssize_t)len ||
+            (uint32_t)cache_hash(buf, len, key[1]) != slot->check)
+            return false;
+
+        emit->len += len;
+        return true;
+    }
+
+    return false;
+}
+
+static void cache_store(struct mcs51_cache *cache, const uint64_t *key,
+                        const char *buf, uint32_t len, unsigned int exit)
+{
+    struct mcs51_cache_slot *slot;
+    unsigned int probe;
+    const char *walk;
+    ssize_t retval;
+    size_t remain;
+    off_t offset;
+
+    pthread_mutex_lock(&cache->lock);
+    if (flock(cache->index_fd, LOCK_EX))
+        goto unlock;
+
+    for (probe = 0; probe < CACHE_PROBES; ++probe) {
+        slot = &cache->slots[(key[0] + probe) % CACHE_SLOTS];
+        if (!slot->key[0])
+            break;
+        if (slot->key[0] == key[0] && slot->key[1] == key[1])
+            goto unlock_file;
+    }
+
+    /* probe run full, the block simply stays uncached */
+    if (probe == CACHE_PROBES)
+        goto unlock_file;
+
+    if ((offset = lseek(cache->blob_fd, 0, SEEK_END)) < 0)
+        goto unlock_file;
+
+    for (walk = buf, remain = len; remain; walk += retval, remain -= retval) {
+        if ((retval = write(cache->blob_fd, walk, remain)) < 0) {
+            if (errno == EINTR) {
+                retval = 0;
+                continue;
+            }
+            goto unlock_file;
+        }
+    }
+
+    slot->offset = offset;
+    slot->len = len;
+    slot->check = cache_hash(buf, len, key[1]);
+    slot->exit = exit;
+    slot->key[1] = key[1];
+    __atomic_store_n(&slot->key[0], key[0], __ATOMIC_RELEASE);
+
+unlock_file:
+    flock(cache->index_fd, LOCK_UN);
+unlock:
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * mcs51_emit_cached - linear sweep reusing previously rendered blocks.
+ * @cache: cache opened with the symbols of @emit.
+ * @emit: emitter to write to, grown to cache_render of its format.
+ * @data: start of the image.
+ * @size: size of @data.
+ * @base: load address of @data.
+ *
+ * The image is handled in blocks of 4 KiB. A block is keyed by its
+ * bytes, the bytes its last instruction may run into, the offset the
+ * sweep enters it at, its address, which every listing line carries,
+ * and the output format of @emit. Output is identical to
+ * mcs51_emit_range over the whole image.
+ */
+void mcs51_emit_cached(struct mcs51_cache *cache, struct mcs51_emit *emit,
+                       const uint8_t *data, size_t size, uint32_t base)
+{
+    size_t start, end, span, offset, mark;
+    unsigned int entry, exit;
+    uint64_t key[2], seed;
+
+    for (start = offset = 0; start < size; start = end) {
+        end = start + CACHE_BLOCK < size ? start + CACHE_BLOCK : size;
+        entry = offset - start;
+
+        seed = cache->seed ^ ((uint64_t)emit->output << 56 |
+                              (uint64_t)(base + start) << 8 | entry);
+        span = (end + CACHE_TAIL < size ? end + CACHE_TAIL : size) - start;
+        key[0] = cache_hash(data + start, span, seed) | 1;
+        key[1] = cache_hash(data + start, span, ~seed);
+
+        if (cache_lookup(cache, emit, key, &exit)) {
+            __atomic_fetch_add(&cache->hits, 1, __ATOMIC_RELAXED);
+            offset = end + exit;
+            continue;
+        }
+
+        /* room for the whole block, so it is still in the buffer after */
+        mcs51_emit_reserve(emit, cache_render(emit->output));
+        mark = emit->len;
+        offset = mcs51_emit_range(emit, data, size, offset, end, base);
+        __atomic_fetch_add(&cache->misses, 1, __ATOMIC_RELAXED);
+
+        /* flushed partway after all, the block is not whole in the buffer */
+        if (emit->len < mark)
+            continue;
+        cache_store(cache, key, emit->buf + mark, emit->len - mark, offset - end);
+    }
+}
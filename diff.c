@@ -0,0 +1,303 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <err.h>
+
+/* Unchanged instructions shown around each change */
+#define DIFF_CONTEXT    3
+
+struct diff_line {
+    struct mcs51_insn insn;
+    char tag;
+};
+
+/**
+ * struct diff_state - instruction diff in progress.
+ * @old: image before.
+ * @new: image after.
+ * @emit: emitter hunks are written to.
+ * @names: names of @old and @new for the file header.
+ * @lines: lines of the open hunk.
+ * @nr_lines: number of valid @lines.
+ * @max_lines: allocated size of @lines.
+ * @adds: added lines of the current change, appended after its removals.
+ * @nr_adds: number of valid @adds.
+ * @max_adds: allocated size of @adds.
+ * @pending: unchanged lines at the end of the open hunk.
+ * @ring: offsets of the latest unchanged instructions.
+ * @fresh: entries of @ring not yet listed in any hunk.
+ * @hunks: number of hunks written.
+ */
+struct diff_state {
+    const struct mcs51_segment *old;
+    const struct mcs51_segment *new;
+    struct mcs51_emit *emit;
+    const char *names[2];
+    struct diff_line *lines;
+    size_t nr_lines, max_lines;
+    struct diff_line *adds;
+    size_t nr_adds, max_adds;
+    unsigned int pending;
+    size_t ring[DIFF_CONTEXT];
+    unsigned int fresh;
+    unsigned long hunks;
+};
+
+/* Offset of the first byte that differs at or after @pos, or @size */
+static size_t diff_mismatch(const uint8_t *a, const uint8_t *b, size_t pos, size_t size)
+{
+    uint64_t wa, wb, delta;
+
+    for (; pos + 8 <= size; pos += 8) {
+        memcpy(&wa, a + pos, 8);
+        memcpy(&wb, b + pos, 8);
+        if ((delta = wa ^ wb)) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return pos + (__builtin_ctzll(delta) >> 3);
+#else
+            return pos + (__builtin_clzll(delta) >> 3);
+#endif
+        }
+    }
+
+    while (pos < size && a[pos] == b[pos])
+        ++pos;
+
+    return pos;
+}
+
+static unsigned int diff_add(struct diff_line **lines, size_t *nr, size_t *max,
+                             char tag, const struct mcs51_segment *seg, size_t offset)
+{
+    struct diff_line *line;
+
+    if (*nr == *max) {
+        *max = *max ? *max * 2 : 64;
+        if (!(*lines = realloc(*lines, *max * sizeof(**lines))))
+            err(-1, "diff alloc err");
+    }
+
+    line = &(*lines)[(*nr)++];
+    line->tag = tag;
+    mcs51_decode(&line->insn, seg->data + offset, seg->size - offset,
+                 seg->addr + offset);
+
+    return line->insn.size;
+}
+
+static unsigned int diff_old(struct diff_state *diff, char tag, size_t offset)
+{
+    return diff_add(&diff->lines, &diff->nr_lines, &diff->max_lines,
+                    tag, diff->old, offset);
+}
+
+static unsigned int diff_new(struct diff_state *diff, size_t offset)
+{
+    return diff_add(&diff->adds, &diff->nr_adds, &diff->max_adds,
+                    '+', diff->new, offset);
+}
+
+static char *diff_range(char *walk, char sign, const struct diff_line *first,
+                        unsigned int count)
+{
+    *walk++ = sign;
+    walk += mcs51_format_addr(walk, first ? first->insn.addr : 0);
+    walk += sprintf(walk, ",%u", count);
+    return walk;
+}
+
+/* Write the open hunk, keeping DIFF_CONTEXT of its trailing context */
+static void diff_flush(struct diff_state *diff)
+{
+    const struct diff_line *line, *old_first = NULL, *new_first = NULL;
+    unsigned int nr_old = 0, nr_new = 0;
+    struct mcs51_emit *emit = diff->emit;
+    char *buf, *walk;
+    size_t index;
+
+    if (!diff->nr_lines)
+        return;
+
+    if (diff->pending > DIFF_CONTEXT)
+        diff->nr_lines -= diff->pending - DIFF_CONTEXT;
+
+    for (index = 0; index < diff->nr_lines; ++index) {
+        line = &diff->lines[index];
+        if (line->tag != '+') {
+            old_first = old_first ? old_first : line;
+            nr_old++;
+        }
+        if (line->tag != '-') {
+            new_first = new_first ? new_first : line;
+            nr_new++;
+        }
+    }
+
+    if (!diff->hunks++) {
+        buf = mcs51_emit_reserve(emit, strlen(diff->names[0]) +
+                                 strlen(diff->names[1]) + 10);
+        emit->len += sprintf(buf, "--- %s\n+++ %s\n", diff->names[0], diff->names[1]);
+    }
+
+    walk = buf = mcs51_emit_reserve(emit, 64);
+    memcpy(walk, "@@ ", 3);
+    walk = diff_range(walk + 3, '-', old_first, nr_old);
+    *walk++ = ' ';
+    walk = diff_range(walk, '+', new_first, nr_new);
+    memcpy(walk, " @@\n", 4);
+    emit->len += walk + 4 - buf;
+
+    for (index = 0; index < diff->nr_lines; ++index) {
+        line = &diff->lines[index];
+        buf = mcs51_emit_reserve(emit, 1);
+        *buf = line->tag;
+        emit->len++;
+        mcs51_emit_insn(emit, &line->insn);
+    }
+
+    diff->nr_lines = 0;
+    diff->pending = 0;
+}
+
+static void diff_ring(struct diff_state *diff, size_t offset)
+{
+    memmove(diff->ring, diff->ring + 1, sizeof(diff->ring) - sizeof(*diff->ring));
+    diff->ring[DIFF_CONTEXT - 1] = offset;
+    if (diff->fresh < DIFF_CONTEXT)
+        diff->fresh++;
+}
+
+/*
+ * Walk the instructions both images share from @pos up to the first
+ * changed byte @end, by length only. Lines are only decoded while they
+ * are context of the open hunk. Returns where the walk stopped.
+ */
+static size_t diff_equal(struct diff_state *diff, size_t pos, size_t end)
+{
+    unsigned int size;
+
+    while (pos < end) {
+        size = mcs51_insn_size(diff->old->data + pos, diff->old->size - pos);
+        if (pos + size > end ||
+            size != mcs51_insn_size(diff->new->data + pos, diff->new->size - pos))
+            break;
+
+        diff_ring(diff, pos);
+        if (diff->nr_lines) {
+            diff_old(diff, ' ', pos);
+            diff->fresh = 0;
+            /* the context dropped by the flush leads the next hunk */
+            if (++diff->pending == DIFF_CONTEXT * 2) {
+                diff_flush(diff);
+                diff->fresh = DIFF_CONTEXT;
+            }
+        }
+
+        pos += size;
+    }
+
+    return pos;
+}
+
+/* Both sides ended, or are on the same boundary with equal bytes */
+static inline bool diff_synced(const struct diff_state *diff, size_t po, size_t pn)
+{
+    const struct mcs51_segment *old = diff->old, *new = diff->new;
+
+    if (po >= old->size && pn >= new->size)
+        return true;
+
+    return po == pn && po < old->size && po < new->size &&
+           old->data[po] == new->data[po];
+}
+
+/*
+ * List both sides from @pos until they are back on a common instruction
+ * boundary with equal bytes, the lagging side always catching up first.
+ */
+static size_t diff_change(struct diff_state *diff, size_t pos)
+{
+    const struct mcs51_segment *old = diff->old, *new = diff->new;
+    size_t po = pos, pn = pos;
+    unsigned int count;
+
+    if (!diff->nr_lines) {
+        for (count = DIFF_CONTEXT - diff->fresh; count < DIFF_CONTEXT; ++count)
+            diff_old(diff, ' ', diff->ring[count]);
+    }
+
+    do {
+        if (po < old->size && (po < pn || pn >= new->size)) {
+            po += diff_old(diff, '-', po);
+        } else if (pn < new->size && (pn < po || po >= old->size)) {
+            pn += diff_new(diff, pn);
+        } else {
+            po += diff_old(diff, '-', po);
+            pn += diff_new(diff, pn);
+        }
+    } while (!diff_synced(diff, po, pn));
+
+    if (diff->nr_lines + diff->nr_adds > diff->max_lines) {
+        diff->max_lines = diff->nr_lines + diff->nr_adds;
+        diff->lines = realloc(diff->lines, diff->max_lines * sizeof(*diff->lines));
+        if (!diff->lines)
+            err(-1, "diff alloc err");
+    }
+
+    memcpy(diff->lines + diff->nr_lines, diff->adds, diff->nr_adds * sizeof(*diff->adds));
+    diff->nr_lines += diff->nr_adds;
+    diff->nr_adds = 0;
+    diff->pending = 0;
+    diff->fresh = 0;
+
+    /* equal unless both sides ran out */
+    return po > pn ? po : pn;
+}
+
+/**
+ * mcs51_emit_diff - instruction level diff of two revisions of an image.
+ * @emit: emitter to write to.
+ * @old: image before, mapped at the same address as @new.
+ * @new: image after.
+ * @old_name: name of @old for the file header.
+ * @new_name: name of @new for the file header.
+ *
+ * Unchanged stretches are found by comparing a word at a time and
+ * crossed by instruction length alone, so only the instructions around
+ * a change are decoded. A change runs until both sides meet on the same
+ * instruction boundary again. The result reads like a unified diff of
+ * the two listings, with addresses in the hunk headers. Returns the
+ * number of hunks, zero when the listings are identical.
+ */
+unsigned long mcs51_emit_diff(struct mcs51_emit *emit, const struct mcs51_segment *old,
+                              const struct mcs51_segment *new,
+                              const char *old_name, const char *new_name)
+{
+    struct diff_state diff = {
+        .old = old,
+        .new = new,
+        .emit = emit,
+        .names = { old_name, new_name },
+    };
+    size_t pos = 0, end, min;
+
+    min = old->size < new->size ? old->size : new->size;
+
+    for (;;) {
+        end = diff_mismatch(old->data, new->data, pos, min);
+        pos = diff_equal(&diff, pos, end);
+        if (pos >= old->size && pos >= new->size)
+            break;
+        pos = diff_change(&diff, pos);
+    }
+
+    diff_flush(&diff);
+    free(diff.lines);
+    free(diff.adds);
+
+    return diff.hunks;
+}
@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+void mcs51_emit_init(struct mcs51_emit *emit, int fd, size_t size)
+{
+    emit->fd = fd;
+    emit->len = 0;
+    emit->size = size;
+    emit->sym = NULL;
+    emit->output = MCS51_OUTPUT_TEXT;
+
+    if (!(emit->buf = malloc(size)))
+        err(-1, "emit buffer alloc err");
+}
+
+void mcs51_emit_exit(struct mcs51_emit *emit)
+{
+    mcs51_emit_flush(emit);
+    free(emit->buf);
+    emit->buf = NULL;
+}
+
+void mcs51_emit_flush(struct mcs51_emit *emit)
+{
+    const char *walk = emit->buf;
+    size_t len = emit->len;
+    ssize_t retval;
+
+    if (emit->fd < 0)
+        return;
+
+    while (len) {
+        retval = write(emit->fd, walk, len);
+        if (retval < 0) {
+            if (errno == EINTR)
+                continue;
+            err(-1, "output write err");
+        }
+        walk += retval;
+        len -= retval;
+    }
+
+    emit->len = 0;
+}
+
+/**
+ * mcs51_emit_room - flush or grow the buffer for @size more bytes.
+ * @emit: emitter to make room on.
+ * @size: number of bytes needed.
+ *
+ * An emitter with a file is flushed first and only grown when @size
+ * exceeds the whole buffer.
+ */
+void mcs51_emit_room(struct mcs51_emit *emit, size_t size)
+{
+    if (emit->fd >= 0) {
+        mcs51_emit_flush(emit);
+        if (emit->size >= size)
+            return;
+    }
+
+    while (emit->size - emit->len < size)
+        emit->size *= 2;
+
+    if (!(emit->buf = realloc(emit->buf, emit->size)))
+        err(-1, "emit buffer alloc err");
+}
+
+/**
+ * mcs51_emit_insn - queue one listing line.
+ * @emit: emitter to write to.
+ * @insn: instruction to render.
+ *
+ * The line matches printf("0x%04lx:") followed by print_insn_mcs51.
+ * Records marked MCS51_INSN_LABEL are preceded by a label line.
+ * Other output formats are handed to their backend.
+ */
+void mcs51_emit_insn(struct mcs51_emit *emit, const struct mcs51_insn *insn)
+{
+    char *buf, *walk;
+
+    switch (emit->output) {
+        case MCS51_OUTPUT_TEXT:
+            break;
+
+        case MCS51_OUTPUT_JSON:
+            mcs51_emit_json(emit, insn);
+            return;
+
+        case MCS51_OUTPUT_BIN:
+            mcs51_emit_record(emit, insn);
+            return;
+    }
+
+    walk = buf = mcs51_emit_reserve(emit, MCS51_LINE_MAX + 32);
+    if (insn->flags & MCS51_INSN_LABEL) {
+        walk += mcs51_format_label(walk, insn->addr);
+        *walk++ = ':';
+        *walk++ = '\n';
+    }
+
+    walk += mcs51_format_addr(walk, insn->addr);
+    *walk++ = ':';
+    walk += mcs51_format_insn(walk, insn, emit->sym);
+    *walk++ = '\n';
+
+    emit->len += walk - buf;
+}
+
+/**
+ * mcs51_emit_range - linear sweep over part of an image.
+ * @emit: emitter to write to.
+ * @data: start of the image.
+ * @size: size of @data, nothing past it is read.
+ * @start: offset of the first instruction.
+ * @end: offset to stop at.
+ * @base: load address of @data.
+ *
+ * Returns the offset following the last instruction, which may lie
+ * beyond @end when an instruction straddles it.
+ */
+size_t mcs51_emit_range(struct mcs51_emit *emit, const uint8_t *data,
+                        size_t size, size_t start, size_t end, uint32_t base)
+{
+    struct mcs51_insn insn;
+    size_t offset;
+
+    for (offset = start; offset < end; offset += insn.size) {
+        mcs51_decode(&insn, data + offset, size - offset, base + offset);
+        mcs51_emit_insn(emit, &insn);
+    }
+
+    return offset;
+}
@@ -0,0 +1,792 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+
+/* Special function registers and bits the emulator follows */
+#define EMU_DPL     0x82
+#define EMU_DPH     0x83
+#define EMU_PSW     0xd0
+#define EMU_ACC     0xe0
+#define EMU_B       0xf0
+#define EMU_CY      0xd7
+
+/* Register banks occupy internal RAM below this address */
+#define EMU_BANKS   0x20
+
+/**
+ * mcs51_emu_reset - forget everything about the machine state.
+ * @emu: state to reset.
+ */
+void mcs51_emu_reset(struct mcs51_emu *emu)
+{
+    memset(emu->lo, 0, sizeof(emu->lo));
+    memset(emu->hi, 0xff, sizeof(emu->hi));
+    emu->dptr = 0;
+    emu->dptr_known = false;
+    emu->dptr_wide = false;
+    emu->alias = MCS51_EMU_NONE;
+    emu->carry = MCS51_CARRY_ANY;
+}
+
+/**
+ * mcs51_emu_join - widen a state to also cover another path.
+ * @emu: state to widen.
+ * @other: state of the path arriving.
+ * @widen: give up on every interval that still grows.
+ *
+ * Intervals become their hull, dptr, the alias and the carry relation
+ * stay only where both paths agree. @widen bounds how often a loop
+ * counter is joined one value at a time. Returns true when @emu changed.
+ */
+bool mcs51_emu_join(struct mcs51_emu *emu, const struct mcs51_emu *other, bool widen)
+{
+    unsigned int loc;
+    bool changed = false;
+
+    for (loc = 0; loc < MCS51_EMU_LOCS; ++loc) {
+        if (other->lo[loc] >= emu->lo[loc] && other->hi[loc] <= emu->hi[loc])
+            continue;
+        if (widen) {
+            emu->lo[loc] = 0;
+            emu->hi[loc] = 0xff;
+        } else {
+            if (other->lo[loc] < emu->lo[loc])
+                emu->lo[loc] = other->lo[loc];
+            if (other->hi[loc] > emu->hi[loc])
+                emu->hi[loc] = other->hi[loc];
+        }
+        changed = true;
+    }
+
+    if (emu->dptr_known && (!other->dptr_known || other->dptr != emu->dptr ||
+        other->dptr_wide != emu->dptr_wide)) {
+        emu->dptr_known = false;
+        changed = true;
+    }
+
+    if (emu->alias != MCS51_EMU_NONE && other->alias != emu->alias) {
+        emu->alias = MCS51_EMU_NONE;
+        changed = true;
+    }
+
+    if (emu->carry != MCS51_CARRY_ANY && (other->carry != emu->carry ||
+        (emu->carry >= MCS51_CARRY_LT && (other->cloc != emu->cloc ||
+        other->cval != emu->cval)))) {
+        emu->carry = MCS51_CARRY_ANY;
+        changed = true;
+    }
+
+    return changed;
+}
+
+/* Out of range intervals wrapped around somewhere, give up on them */
+static void emu_set(struct mcs51_emu *emu, unsigned int loc,
+                    unsigned int lo, unsigned int hi)
+{
+    if (lo > hi || hi > 0xff) {
+        lo = 0;
+        hi = 0xff;
+    }
+
+    emu->lo[loc] = lo;
+    emu->hi[loc] = hi;
+
+    if (loc == MCS51_EMU_A || loc == emu->alias)
+        emu->alias = MCS51_EMU_NONE;
+    if (emu->carry >= MCS51_CARRY_LT && emu->cloc == loc)
+        emu->carry = MCS51_CARRY_ANY;
+}
+
+static inline void emu_forget(struct mcs51_emu *emu, unsigned int loc)
+{
+    emu_set(emu, loc, 0, 0xff);
+}
+
+static void emu_forget_regs(struct mcs51_emu *emu)
+{
+    unsigned int reg;
+
+    for (reg = 0; reg < 8; ++reg)
+        emu_forget(emu, reg);
+}
+
+static void emu_const(struct mcs51_emu *emu, unsigned int loc, unsigned int value)
+{
+    emu_set(emu, loc, value & 0xff, value & 0xff);
+}
+
+/* A and a register now hold the same value */
+static void emu_move(struct mcs51_emu *emu, unsigned int dst, unsigned int src)
+{
+    emu_set(emu, dst, emu->lo[src], emu->hi[src]);
+    if (src < 8 || dst < 8)
+        emu->alias = src < 8 ? src : dst;
+}
+
+static inline bool emu_known(const struct mcs51_emu *emu, unsigned int loc)
+{
+    return emu->lo[loc] == emu->hi[loc];
+}
+
+/**
+ * emu_narrow - restrict a location on one side of a branch.
+ * @emu: state of that side.
+ * @loc: location to restrict.
+ * @lo: lowest value possible on this side.
+ * @hi: highest value possible on this side.
+ *
+ * A and the register it aliases are restricted together. When nothing
+ * is left the side cannot be taken, what is known stays as it is.
+ */
+static void emu_narrow(struct mcs51_emu *emu, unsigned int loc,
+                       unsigned int lo, unsigned int hi)
+{
+    unsigned int other = MCS51_EMU_NONE;
+
+    if (lo < emu->lo[loc])
+        lo = emu->lo[loc];
+    if (hi > emu->hi[loc])
+        hi = emu->hi[loc];
+    if (lo > hi)
+        return;
+
+    if (loc == MCS51_EMU_A)
+        other = emu->alias;
+    else if (loc == emu->alias)
+        other = MCS51_EMU_A;
+
+    emu->lo[loc] = lo;
+    emu->hi[loc] = hi;
+    if (other != MCS51_EMU_NONE) {
+        emu->lo[other] = lo;
+        emu->hi[other] = hi;
+    }
+}
+
+/**
+ * emu_relate - tie the carry flag to a comparison of a location.
+ * @emu: state to update.
+ * @kind: MCS51_CARRY_LT or MCS51_CARRY_GE.
+ * @loc: location compared.
+ * @value: bound it is compared against, up to 0x100.
+ */
+static void emu_relate(struct mcs51_emu *emu, unsigned int kind,
+                       unsigned int loc, unsigned int value)
+{
+    bool below;
+
+    if (emu->hi[loc] < value)
+        below = true;
+    else if (emu->lo[loc] >= value)
+        below = false;
+    else {
+        emu->carry = kind;
+        emu->cloc = loc;
+        emu->cval = value;
+        return;
+    }
+
+    emu->carry = below == (kind == MCS51_CARRY_LT) ?
+                 MCS51_CARRY_SET : MCS51_CARRY_CLEAR;
+}
+
+/* The carry flag is known on this side of a jc, jnc, jb c or jnb c */
+static void emu_carry(struct mcs51_emu *emu, bool set)
+{
+    switch (emu->carry) {
+        case MCS51_CARRY_LT:
+            if (set)
+                emu_narrow(emu, emu->cloc, 0, emu->cval - 1);
+            else
+                emu_narrow(emu, emu->cloc, emu->cval, 0xff);
+            break;
+
+        case MCS51_CARRY_GE:
+            if (set)
+                emu_narrow(emu, emu->cloc, emu->cval, 0xff);
+            else
+                emu_narrow(emu, emu->cloc, 0, emu->cval - 1);
+            break;
+    }
+
+    emu->carry = set ? MCS51_CARRY_SET : MCS51_CARRY_CLEAR;
+}
+
+/**
+ * emu_add - add an interval to A.
+ * @emu: state to update.
+ * @lo: lowest addend.
+ * @hi: highest addend.
+ * @immed: the constant addend of add a,#immed, zero otherwise.
+ *
+ * When the sum may or may not wrap, the carry of add a,#immed still
+ * says which way it went: it is set iff the old A was at least
+ * 0x100 - @immed, or iff the new A is below @immed.
+ */
+static void emu_add(struct mcs51_emu *emu, unsigned int lo, unsigned int hi,
+                    unsigned int immed)
+{
+    unsigned int alo = emu->lo[MCS51_EMU_A], ahi = emu->hi[MCS51_EMU_A];
+    unsigned int alias = emu->alias;
+
+    if (ahi + hi <= 0xff) {
+        emu_set(emu, MCS51_EMU_A, alo + lo, ahi + hi);
+        emu->carry = MCS51_CARRY_CLEAR;
+    } else if (alo + lo > 0xff) {
+        emu_set(emu, MCS51_EMU_A, alo + lo - 0x100, ahi + hi - 0x100);
+        emu->carry = MCS51_CARRY_SET;
+    } else {
+        emu_forget(emu, MCS51_EMU_A);
+        if (!immed)
+            emu->carry = MCS51_CARRY_ANY;
+        else if (alias != MCS51_EMU_NONE)
+            emu_relate(emu, MCS51_CARRY_GE, alias, 0x100 - immed);
+        else
+            emu_relate(emu, MCS51_CARRY_LT, MCS51_EMU_A, immed);
+    }
+}
+
+/**
+ * emu_sub - subtract an interval from A with the carry known clear.
+ * @emu: state to update.
+ * @lo: lowest subtrahend.
+ * @hi: highest subtrahend.
+ * @immed: the constant of subb a,#immed, zero otherwise.
+ * @reg: the register of subb a,rn, MCS51_EMU_NONE otherwise.
+ *
+ * The borrow is tied to the operands like the carry of emu_add, which
+ * covers both "subb a,#n" and "mov a,#n; subb a,rn" bound checks.
+ */
+static void emu_sub(struct mcs51_emu *emu, unsigned int lo, unsigned int hi,
+                    unsigned int immed, unsigned int reg)
+{
+    unsigned int alo = emu->lo[MCS51_EMU_A], ahi = emu->hi[MCS51_EMU_A];
+    unsigned int alias = emu->alias;
+
+    if (alo >= hi) {
+        emu_set(emu, MCS51_EMU_A, alo - hi, ahi - lo);
+        emu->carry = MCS51_CARRY_CLEAR;
+    } else if (ahi < lo) {
+        emu_set(emu, MCS51_EMU_A, alo - hi + 0x100, ahi - lo + 0x100);
+        emu->carry = MCS51_CARRY_SET;
+    } else {
+        emu_forget(emu, MCS51_EMU_A);
+        if (immed && alias != MCS51_EMU_NONE)
+            emu_relate(emu, MCS51_CARRY_LT, alias, immed);
+        else if (immed)
+            emu_relate(emu, MCS51_CARRY_GE, MCS51_EMU_A, 0x100 - immed);
+        else if (reg != MCS51_EMU_NONE && alo == ahi)
+            emu_relate(emu, MCS51_CARRY_GE, reg, alo + 1);
+        else
+            emu->carry = MCS51_CARRY_ANY;
+    }
+}
+
+/* A direct address was written with something unknown */
+static void emu_direct(struct mcs51_emu *emu, unsigned int addr)
+{
+    if (addr < EMU_BANKS) {
+        emu_forget_regs(emu);
+        return;
+    }
+
+    switch (addr) {
+        case EMU_ACC:
+            emu_forget(emu, MCS51_EMU_A);
+            break;
+
+        case EMU_B:
+            emu_forget(emu, MCS51_EMU_B);
+            break;
+
+        case EMU_DPL: case EMU_DPH:
+            emu->dptr_known = false;
+            break;
+
+        case EMU_PSW:
+            emu_forget_regs(emu);
+            emu->carry = MCS51_CARRY_ANY;
+            break;
+    }
+}
+
+/* A bit was written, only the carry and register bank bits matter */
+static void emu_bit(struct mcs51_emu *emu, unsigned int bit)
+{
+    if (bit < 0x80)
+        return;
+
+    if (bit == EMU_CY)
+        emu->carry = MCS51_CARRY_ANY;
+    else if ((bit & 0xf8) == EMU_PSW)
+        emu_forget_regs(emu);
+    else
+        emu_direct(emu, bit & 0xf8);
+}
+
+/* Escaped instructions work on the alternate /dptr, which is not followed */
+static void emu_escaped(struct mcs51_emu *emu, const struct mcs51_insn *insn)
+{
+    switch (insn->ops->format) {
+        case MCS51_INS_ATP: case MCS51_INS_ATA:
+            emu_forget(emu, MCS51_EMU_A);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * mcs51_emu_step - apply one instruction to the machine state.
+ * @emu: state before @insn, left as the state on the fall through path.
+ * @taken: filled with the state at the branch target.
+ * @insn: decoded instruction.
+ *
+ * Values are intervals over R0-R7, A and B plus a constant dptr, and
+ * the carry may be tied to a bound check so jc and jnc restrict the
+ * checked location on each side. Anything not followed is forgotten,
+ * and a call forgets everything on both sides.
+ */
+void mcs51_emu_step(struct mcs51_emu *emu, struct mcs51_emu *taken,
+                    const struct mcs51_insn *insn)
+{
+    unsigned int reg = insn->reg, lo, hi;
+    bool meet, split = false;
+
+    if (insn->flags & MCS51_INSN_CALL) {
+        mcs51_emu_reset(emu);
+        mcs51_emu_reset(taken);
+        return;
+    }
+
+    if (insn->prefix) {
+        emu_escaped(emu, insn);
+        *taken = *emu;
+        return;
+    }
+
+    /* Both sides of "cjne a,#n,$+3" meet again, neither can be restricted */
+    meet = insn->target == insn->addr + insn->size;
+
+    switch (insn->opcode) {
+        case 0x00: case 0x01: case 0x02: case 0x21: case 0x22: case 0x32:
+        case 0x41: case 0x61: case 0x73: case 0x80: case 0x81: case 0xa1:
+        case 0xc1: case 0xe1: case 0xf0: case 0xf2: case 0xf3:
+            break;
+
+        /* SP is not followed, the push may land in any register bank */
+        case 0xc0:
+            emu_forget_regs(emu);
+            break;
+
+        case 0x03:
+            emu_forget(emu, MCS51_EMU_A);
+            break;
+
+        case 0xc4:
+            if (emu_known(emu, MCS51_EMU_A))
+                emu_const(emu, MCS51_EMU_A, emu->lo[MCS51_EMU_A] * 0x101 >> 4);
+            else
+                emu_forget(emu, MCS51_EMU_A);
+            break;
+
+        case 0x13: case 0x33: case 0xd4:
+            emu_forget(emu, MCS51_EMU_A);
+            emu->carry = MCS51_CARRY_ANY;
+            break;
+
+        case 0x23:
+            lo = emu->lo[MCS51_EMU_A];
+            hi = emu->hi[MCS51_EMU_A];
+            if (hi < 0x80)
+                emu_set(emu, MCS51_EMU_A, lo * 2, hi * 2);
+            else if (lo == hi)
+                emu_const(emu, MCS51_EMU_A, lo * 2 | lo >> 7);
+            else
+                emu_forget(emu, MCS51_EMU_A);
+            break;
+
+        case 0x04:
+            emu_set(emu, MCS51_EMU_A, emu->lo[MCS51_EMU_A] + 1, emu->hi[MCS51_EMU_A] + 1);
+            break;
+
+        case 0x14:
+            emu_set(emu, MCS51_EMU_A, emu->lo[MCS51_EMU_A] - 1, emu->hi[MCS51_EMU_A] - 1);
+            break;
+
+        case 0x08 ... 0x0f:
+            emu_set(emu, reg, emu->lo[reg] + 1, emu->hi[reg] + 1);
+            break;
+
+        case 0x18 ... 0x1f:
+            emu_set(emu, reg, emu->lo[reg] - 1, emu->hi[reg] - 1);
+            break;
+
+        case 0x05: case 0x15: case 0x42: case 0x43: case 0x52: case 0x53:
+        case 0x62: case 0x63: case 0x86: case 0x87: case 0xd0: case 0xd5:
+            emu_direct(emu, insn->direct);
+            break;
+
+        case 0x06: case 0x07: case 0x16: case 0x17: case 0x76: case 0x77:
+        case 0xa6: case 0xa7: case 0xf6: case 0xf7:
+            emu_forget_regs(emu);
+            break;
+
+        case 0x24:
+            emu_add(emu, insn->immed, insn->immed, insn->immed);
+            break;
+
+        case 0x34:
+            if (emu->carry == MCS51_CARRY_CLEAR)
+                emu_add(emu, insn->immed, insn->immed, insn->immed);
+            else {
+                emu_forget(emu, MCS51_EMU_A);
+                emu->carry = MCS51_CARRY_ANY;
+            }
+            break;
+
+        case 0x25: case 0x35:
+            if (insn->direct == EMU_ACC && (insn->opcode == 0x25 ||
+                emu->carry == MCS51_CARRY_CLEAR))
+                emu_add(emu, emu->lo[MCS51_EMU_A], emu->hi[MCS51_EMU_A], 0);
+            else {
+                emu_forget(emu, MCS51_EMU_A);
+                emu->carry = MCS51_CARRY_ANY;
+            }
+            break;
+
+        case 0x28 ... 0x2f: case 0x38 ... 0x3f:
+            if (insn->opcode < 0x30 || emu->carry == MCS51_CARRY_CLEAR)
+                emu_add(emu, emu->lo[reg], emu->hi[reg], 0);
+            else {
+                emu_forget(emu, MCS51_EMU_A);
+                emu->carry = MCS51_CARRY_ANY;
+            }
+            break;
+
+        case 0x94:
+            if (emu->carry == MCS51_CARRY_CLEAR)
+                emu_sub(emu, insn->immed, insn->immed, insn->immed, MCS51_EMU_NONE);
+            else {
+                emu_forget(emu, MCS51_EMU_A);
+                emu->carry = MCS51_CARRY_ANY;
+            }
+            break;
+
+        case 0x98 ... 0x9f:
+            if (emu->carry == MCS51_CARRY_CLEAR)
+                emu_sub(emu, emu->lo[reg], emu->hi[reg], 0, reg);
+            else {
+                emu_forget(emu, MCS51_EMU_A);
+                emu->carry = MCS51_CARRY_ANY;
+            }
+            break;
+
+        case 0x26: case 0x27: case 0x36: case 0x37:
+        case 0x95: case 0x96: case 0x97:
+            emu_forget(emu, MCS51_EMU_A);
+            emu->carry = MCS51_CARRY_ANY;
+            break;
+
+        case 0x54: case 0x58 ... 0x5f:
+            lo = insn->opcode == 0x54 ? insn->immed : emu->lo[reg];
+            hi = insn->opcode == 0x54 ? insn->immed : emu->hi[reg];
+            if (lo == hi && emu_known(emu, MCS51_EMU_A))
+                emu_const(emu, MCS51_EMU_A, emu->lo[MCS51_EMU_A] & lo);
+            else
+                emu_set(emu, MCS51_EMU_A, 0, hi < emu->hi[MCS51_EMU_A] ?
+                        hi : emu->hi[MCS51_EMU_A]);
+            break;
+
+        case 0x55: case 0x56: case 0x57:
+            emu_set(emu, MCS51_EMU_A, 0, emu->hi[MCS51_EMU_A]);
+            break;
+
+        case 0x44: case 0x48 ... 0x4f: case 0x64: case 0x68 ... 0x6f:
+            lo = insn->opcode & 0x08 ? emu->lo[reg] : insn->immed;
+            hi = insn->opcode & 0x08 ? emu->hi[reg] : insn->immed;
+            if (lo == hi && emu_known(emu, MCS51_EMU_A))
+                emu_const(emu, MCS51_EMU_A, insn->opcode < 0x60 ?
+                          emu->lo[MCS51_EMU_A] | lo : emu->lo[MCS51_EMU_A] ^ lo);
+            else
+                emu_forget(emu, MCS51_EMU_A);
+            break;
+
+        case 0x45: case 0x46: case 0x47: case 0x65: case 0x66: case 0x67:
+        case 0x83: case 0x93: case 0xe0: case 0xe2: case 0xe3: case 0xe6:
+        case 0xe7:
+            emu_forget(emu, MCS51_EMU_A);
+            break;
+
+        case 0xc6: case 0xc7: case 0xd6: case 0xd7:
+            emu_forget(emu, MCS51_EMU_A);
+            emu_forget_regs(emu);
+            break;
+
+        case 0x72: case 0x82: case 0xa0: case 0xb0:
+            emu->carry = MCS51_CARRY_ANY;
+            break;
+
+        case 0xa2:
+            if (insn->bit != EMU_CY)
+                emu->carry = MCS51_CARRY_ANY;
+            break;
+
+        case 0x92:
+            emu_bit(emu, insn->bit);
+            break;
+
+        case 0xc2: case 0xd2:
+            if (insn->bit == EMU_CY)
+                emu->carry = insn->opcode == 0xd2 ? MCS51_CARRY_SET : MCS51_CARRY_CLEAR;
+            else
+                emu_bit(emu, insn->bit);
+            break;
+
+        case 0xc3:
+            emu->carry = MCS51_CARRY_CLEAR;
+            break;
+
+        case 0xd3:
+            emu->carry = MCS51_CARRY_SET;
+            break;
+
+        case 0xb2: case 0xb3:
+            if (insn->opcode == 0xb2 && insn->bit != EMU_CY)
+                emu_bit(emu, insn->bit);
+            else if (emu->carry == MCS51_CARRY_SET || emu->carry == MCS51_CARRY_CLEAR)
+                emu->carry ^= MCS51_CARRY_SET ^ MCS51_CARRY_CLEAR;
+            else
+                emu->carry = MCS51_CARRY_ANY;
+            break;
+
+        case 0x74:
+            emu_const(emu, MCS51_EMU_A, insn->immed);
+            break;
+
+        case 0x78 ... 0x7f:
+            emu_const(emu, reg, insn->immed);
+            break;
+
+        case 0x75:
+            if (insn->direct == EMU_ACC)
+                emu_const(emu, MCS51_EMU_A, insn->immed);
+            else if (insn->direct == EMU_B)
+                emu_const(emu, MCS51_EMU_B, insn->immed);
+            else
+                emu_direct(emu, insn->direct);
+            break;
+
+        case 0x85:
+            emu_direct(emu, insn->direct2);
+            break;
+
+        case 0x88 ... 0x8f:
+            if (insn->direct == EMU_ACC)
+                emu_move(emu, MCS51_EMU_A, reg);
+            else if (insn->direct == EMU_B)
+                emu_set(emu, MCS51_EMU_B, emu->lo[reg], emu->hi[reg]);
+            else
+                emu_direct(emu, insn->direct);
+            break;
+
+        case 0xa8 ... 0xaf:
+            if (insn->direct == EMU_ACC)
+                emu_move(emu, reg, MCS51_EMU_A);
+            else if (insn->direct == EMU_B)
+                emu_set(emu, reg, emu->lo[MCS51_EMU_B], emu->hi[MCS51_EMU_B]);
+            else
+                emu_forget(emu, reg);
+            break;
+
+        case 0xe5:
+            if (insn->direct == EMU_B)
+                emu_set(emu, MCS51_EMU_A, emu->lo[MCS51_EMU_B], emu->hi[MCS51_EMU_B]);
+            else if (insn->direct != EMU_ACC)
+                emu_forget(emu, MCS51_EMU_A);
+            break;
+
+        case 0xf5:
+            if (insn->direct == EMU_B)
+                emu_set(emu, MCS51_EMU_B, emu->lo[MCS51_EMU_A], emu->hi[MCS51_EMU_A]);
+            else if (insn->direct != EMU_ACC)
+                emu_direct(emu, insn->direct);
+            break;
+
+        case 0xc5:
+            if (insn->direct != EMU_ACC) {
+                emu_forget(emu, MCS51_EMU_A);
+                emu_direct(emu, insn->direct);
+            }
+            break;
+
+        case 0xe8 ... 0xef:
+            emu_move(emu, MCS51_EMU_A, reg);
+            break;
+
+        case 0xf8 ... 0xff:
+            emu_move(emu, reg, MCS51_EMU_A);
+            break;
+
+        case 0xc8 ... 0xcf:
+            if (emu->alias != reg) {
+                lo = emu->lo[reg];
+                hi = emu->hi[reg];
+                emu_set(emu, reg, emu->lo[MCS51_EMU_A], emu->hi[MCS51_EMU_A]);
+                emu_set(emu, MCS51_EMU_A, lo, hi);
+            }
+            break;
+
+        case 0xe4:
+            emu_const(emu, MCS51_EMU_A, 0);
+            break;
+
+        case 0xf4:
+            emu_set(emu, MCS51_EMU_A, 0xff - emu->hi[MCS51_EMU_A],
+                    0xff - emu->lo[MCS51_EMU_A]);
+            break;
+
+        case 0x84: case 0xa4:
+            lo = emu->lo[MCS51_EMU_A];
+            hi = emu->hi[MCS51_EMU_A];
+            if (!emu_known(emu, MCS51_EMU_B) || (insn->opcode == 0x84 &&
+                (!emu->lo[MCS51_EMU_B] || lo != hi)) ||
+                (insn->opcode == 0xa4 && hi * emu->lo[MCS51_EMU_B] > 0xff)) {
+                emu_forget(emu, MCS51_EMU_A);
+                emu_forget(emu, MCS51_EMU_B);
+            } else if (insn->opcode == 0x84) {
+                emu_const(emu, MCS51_EMU_A, lo / emu->lo[MCS51_EMU_B]);
+                emu_const(emu, MCS51_EMU_B, lo % emu->lo[MCS51_EMU_B]);
+            } else {
+                emu_set(emu, MCS51_EMU_A, lo * emu->lo[MCS51_EMU_B],
+                        hi * emu->lo[MCS51_EMU_B]);
+                emu_const(emu, MCS51_EMU_B, 0);
+            }
+            emu->carry = MCS51_CARRY_CLEAR;
+            break;
+
+        case 0x90:
+            emu->dptr_wide = insn->ops->format == MCS51_INS_PTL;
+            emu->dptr = emu->dptr_wide ? insn->addr24 : insn->addr16;
+            emu->dptr_known = true;
+            break;
+
+        case 0xa3:
+            emu->dptr = (emu->dptr + 1) & (emu->dptr_wide ? 0xffffff : 0xffff);
+            break;
+
+        case 0x40: case 0x50:
+            if (meet)
+                break;
+            *taken = *emu;
+            emu_carry(taken, insn->opcode == 0x40);
+            emu_carry(emu, insn->opcode != 0x40);
+            split = true;
+            break;
+
+        case 0x10: case 0x20: case 0x30:
+            if (insn->opcode == 0x10)
+                emu_bit(emu, insn->bit);
+            if (meet)
+                break;
+            *taken = *emu;
+            if (insn->bit == EMU_CY) {
+                emu_carry(taken, insn->opcode != 0x30);
+                emu_carry(emu, insn->opcode == 0x30);
+                if (insn->opcode == 0x10)
+                    taken->carry = MCS51_CARRY_CLEAR;
+            }
+            split = true;
+            break;
+
+        case 0x60: case 0x70:
+            if (meet)
+                break;
+            *taken = *emu;
+            emu_narrow(insn->opcode == 0x60 ? taken : emu, MCS51_EMU_A, 0, 0);
+            emu_narrow(insn->opcode == 0x60 ? emu : taken, MCS51_EMU_A, 1, 0xff);
+            split = true;
+            break;
+
+        case 0xb4: case 0xb8 ... 0xbf:
+            if (insn->opcode == 0xb4)
+                reg = MCS51_EMU_A;
+            emu_relate(emu, MCS51_CARRY_LT, reg, insn->immed);
+            if (meet)
+                break;
+            *taken = *emu;
+            emu_narrow(emu, reg, insn->immed, insn->immed);
+            emu->carry = MCS51_CARRY_CLEAR;
+            split = true;
+            break;
+
+        case 0xb5: case 0xb6: case 0xb7:
+            emu->carry = MCS51_CARRY_ANY;
+            break;
+
+        case 0xd8 ... 0xdf:
+            emu_forget(emu, reg);
+            break;
+
+        default:
+            emu_forget(emu, MCS51_EMU_A);
+            emu->carry = MCS51_CARRY_ANY;
+            break;
+    }
+
+    if (!split)
+        *taken = *emu;
+}
+
+/**
+ * mcs51_emu_table - find the table an indexed instruction reads.
+ * @emu: state before @insn.
+ * @insn: movc a,@a+dptr, movc a,@a+pc or jmp @a+dptr.
+ * @base: filled with the table address.
+ * @lo: filled with the lowest index.
+ * @hi: filled with the highest index.
+ *
+ * Returns true when the base is a constant and the index in A has
+ * been bounded, so the table extent is known.
+ */
+bool mcs51_emu_table(const struct mcs51_emu *emu, const struct mcs51_insn *insn,
+                     uint32_t *base, unsigned int *lo, unsigned int *hi)
+{
+    if (!insn->ops || insn->prefix)
+        return false;
+
+    switch (insn->ops->format) {
+        case MCS51_INS_ATA: case MCS51_INS_TAD:
+            if (!emu->dptr_known)
+                return false;
+            *base = emu->dptr;
+            break;
+
+        case MCS51_INS_ATC:
+            *base = insn->addr + insn->size;
+            break;
+
+        default:
+            return false;
+    }
+
+    *lo = emu->lo[MCS51_EMU_A];
+    *hi = emu->hi[MCS51_EMU_A];
+    return *lo || *hi != 0xff;
+}
+
+/**
+ * mcs51_emu_load - set A to the range of bytes a movc read.
+ * @emu: state after the movc.
+ * @lo: smallest byte in the table.
+ * @hi: largest byte in the table.
+ */
+void mcs51_emu_load(struct mcs51_emu *emu, unsigned int lo, unsigned int hi)
+{
+    emu_set(emu, MCS51_EMU_A, lo, hi);
+}
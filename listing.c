@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <err.h>
+
+void mcs51_listing_init(struct mcs51_listing *listing)
+{
+    memset(listing, 0, sizeof(*listing));
+}
+
+void mcs51_listing_release(struct mcs51_listing *listing)
+{
+    free(listing->insns);
+    listing->insns = NULL;
+    listing->nr_insns = 0;
+}
+
+static struct mcs51_insn *listing_add(struct mcs51_listing *listing)
+{
+    if (listing->nr_insns == listing->max_insns) {
+        listing->max_insns = listing->max_insns ? listing->max_insns * 2 : 4096;
+        listing->insns = realloc(listing->insns,
+                                 listing->max_insns * sizeof(*listing->insns));
+        if (!listing->insns)
+            err(-1, "listing alloc err");
+    }
+
+    return &listing->insns[listing->nr_insns++];
+}
+
+/**
+ * mcs51_listing_find - find the record starting at an address.
+ * @listing: listing to search.
+ * @addr: address of the wanted record.
+ *
+ * Returns NULL when no record starts at @addr.
+ */
+struct mcs51_insn *mcs51_listing_find(const struct mcs51_listing *listing, uint32_t addr)
+{
+    size_t low = 0, high = listing->nr_insns, mid;
+
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (listing->insns[mid].addr < addr)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low == listing->nr_insns || listing->insns[low].addr != addr)
+        return NULL;
+
+    return &listing->insns[low];
+}
+
+/**
+ * mcs51_listing_linear - decode every segment by linear sweep.
+ * @listing: listing to append to.
+ * @segs: image segments sorted by address.
+ * @nr_segs: number of @segs.
+ */
+void mcs51_listing_linear(struct mcs51_listing *listing,
+                          const struct mcs51_segment *segs, size_t nr_segs)
+{
+    const struct mcs51_segment *seg;
+    struct mcs51_insn *insn;
+    size_t index, offset;
+
+    for (index = 0; index < nr_segs; ++index) {
+        seg = &segs[index];
+        for (offset = 0; offset < seg->size; offset += insn->size) {
+            insn = listing_add(listing);
+            mcs51_decode(insn, seg->data + offset, seg->size - offset,
+                         seg->addr + offset);
+        }
+    }
+}
+
+/**
+ * mcs51_listing_trace - decode an image along a finished trace.
+ * @listing: listing to append to.
+ * @trace: trace that has been run.
+ *
+ * Reached instructions are decoded, every other byte becomes a data
+ * record, as in mcs51_trace_emit.
+ */
+void mcs51_listing_trace(struct mcs51_listing *listing, struct mcs51_trace *trace)
+{
+    const struct mcs51_segment *seg;
+    struct mcs51_insn *insn;
+    size_t index, offset;
+
+    for (index = 0; index < trace->nr_segs; ++index) {
+        seg = &trace->segs[index];
+        for (offset = 0; offset < seg->size; offset += insn->size) {
+            insn = listing_add(listing);
+            if (mcs51_bit_test(trace->code, trace->base[index] + offset))
+                mcs51_decode(insn, seg->data + offset, seg->size - offset,
+                             seg->addr + offset);
+            else
+                mcs51_trace_byte(trace, insn, index, offset);
+        }
+    }
+}
+
+/**
+ * mcs51_listing_label - give every branch target a label.
+ * @listing: listing to label.
+ *
+ * Records that are the target of a branch get MCS51_INSN_LABEL, and
+ * branches whose target starts a record get MCS51_INSN_SYMBOLIC so
+ * they print the label instead of the raw operand. Targets landing
+ * inside an instruction or outside the image keep their numbers.
+ */
+void mcs51_listing_label(struct mcs51_listing *listing)
+{
+    struct mcs51_insn *insn, *target;
+    size_t index;
+
+    for (index = 0; index < listing->nr_insns; ++index) {
+        insn = &listing->insns[index];
+        if (!(insn->flags & MCS51_INSN_BRANCH))
+            continue;
+
+        if (!(target = mcs51_listing_find(listing, insn->target)))
+            continue;
+
+        target->flags |= MCS51_INSN_LABEL;
+        insn->flags |= MCS51_INSN_SYMBOLIC;
+    }
+}
+
+void mcs51_listing_emit(const struct mcs51_listing *listing, struct mcs51_emit *emit)
+{
+    size_t index;
+
+    for (index = 0; index < listing->nr_insns; ++index)
+        mcs51_emit_insn(emit, &listing->insns[index]);
+}
@@ -0,0 +1,358 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <errno.h>
+
+/* Invalid digits map to 0x100, which pushes hex_byte above 0xff */
+static const uint16_t hex_value[256] = {
+    [0 ... 255] = 0x100,
+    ['0'] = 0x0, ['1'] = 0x1, ['2'] = 0x2, ['3'] = 0x3, ['4'] = 0x4,
+    ['5'] = 0x5, ['6'] = 0x6, ['7'] = 0x7, ['8'] = 0x8, ['9'] = 0x9,
+    ['a'] = 0xa, ['b'] = 0xb, ['c'] = 0xc, ['d'] = 0xd, ['e'] = 0xe,
+    ['f'] = 0xf, ['A'] = 0xa, ['B'] = 0xb, ['C'] = 0xc, ['D'] = 0xd,
+    ['E'] = 0xe, ['F'] = 0xf,
+};
+
+/* Returns the byte at @text, or a value above 0xff on a bad digit */
+static inline unsigned int hex_byte(const char *text)
+{
+    return (hex_value[(uint8_t)text[0]] << 4) | hex_value[(uint8_t)text[1]];
+}
+
+static int image_setup(struct mcs51_image *image, size_t size)
+{
+    memset(image, 0, sizeof(*image));
+
+    /* two text digits per data byte is the densest any record gets */
+    if (!(image->buf = malloc(size / 2 + 1)))
+        return -ENOMEM;
+
+    return 0;
+}
+
+/*
+ * Append a record payload to the image, extending the last segment when
+ * the record continues it. Returns where the payload should be stored.
+ */
+static uint8_t *image_append(struct mcs51_image *image, uint32_t addr, size_t size)
+{
+    struct mcs51_segment *seg;
+    void *segs;
+
+    seg = image->nr_segs ? &image->segs[image->nr_segs - 1] : NULL;
+    if (seg && seg->addr + seg->size == addr &&
+        seg->data + seg->size == image->buf + image->used) {
+        seg->size += size;
+        goto finish;
+    }
+
+    if (image->nr_segs == image->max_segs) {
+        image->max_segs = image->max_segs ? image->max_segs * 2 : 16;
+        segs = realloc(image->segs, image->max_segs * sizeof(*image->segs));
+        if (!segs)
+            return NULL;
+        image->segs = segs;
+    }
+
+    seg = &image->segs[image->nr_segs++];
+    seg->addr = addr;
+    seg->size = size;
+    seg->data = image->buf + image->used;
+
+finish:
+    image->used += size;
+    return image->buf + image->used - size;
+}
+
+static int segment_cmp(const void *pa, const void *pb)
+{
+    const struct mcs51_segment *a = pa, *b = pb;
+    return a->addr < b->addr ? -1 : a->addr > b->addr;
+}
+
+/* The segment of a coalesced, sorted image that holds @addr */
+static struct mcs51_segment *image_find(struct mcs51_image *image, uint32_t addr)
+{
+    size_t low = 0, high = image->nr_segs, mid;
+
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (image->segs[mid].addr <= addr)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return &image->segs[low - 1];
+}
+
+/*
+ * Sort the segments and merge those that touch or overlap, so every
+ * address appears once and an instruction spanning two records decodes
+ * whole. Where records overlap the last one in the file wins, as it
+ * would when programming a device record by record.
+ */
+static int image_coalesce(struct mcs51_image *image)
+{
+    struct mcs51_segment *order, *seg, *last;
+    size_t index, count, total;
+    uint8_t *buf, *walk;
+
+    if (image->nr_segs < 2)
+        return 0;
+
+    /* segments were appended in file order, keep that for the copy */
+    if (!(order = malloc(image->nr_segs * sizeof(*order))))
+        return -ENOMEM;
+    memcpy(order, image->segs, image->nr_segs * sizeof(*order));
+
+    qsort(image->segs, image->nr_segs, sizeof(*image->segs), segment_cmp);
+
+    for (index = 1, count = 1; index < image->nr_segs; ++index) {
+        seg = &image->segs[index];
+        last = &image->segs[count - 1];
+        if ((uint64_t)seg->addr <= (uint64_t)last->addr + last->size) {
+            if ((uint64_t)seg->addr + seg->size > (uint64_t)last->addr + last->size)
+                last->size = seg->addr + seg->size - last->addr;
+        } else {
+            image->segs[count++] = *seg;
+        }
+    }
+
+    if (count == image->nr_segs) {
+        free(order);
+        return 0;
+    }
+
+    for (index = total = 0; index < count; ++index)
+        total += image->segs[index].size;
+    if (!(buf = malloc(total))) {
+        free(order);
+        return -ENOMEM;
+    }
+
+    for (index = 0, walk = buf; index < count; walk += image->segs[index++].size)
+        image->segs[index].data = walk;
+
+    total = image->nr_segs;
+    image->nr_segs = count;
+    for (index = 0; index < total; ++index) {
+        seg = image_find(image, order[index].addr);
+        memcpy((uint8_t *)seg->data + (order[index].addr - seg->addr),
+               order[index].data, order[index].size);
+    }
+
+    free(order);
+    free(image->buf);
+    image->buf = buf;
+    image->used = walk - buf;
+    return 0;
+}
+
+static int image_finish(struct mcs51_image *image, int retval)
+{
+    if (!retval)
+        retval = image_coalesce(image);
+
+    if (retval) {
+        mcs51_image_release(image);
+        return retval;
+    }
+
+    return 0;
+}
+
+/**
+ * mcs51_load_ihex - parse an Intel HEX file into a sparse image.
+ * @image: image to fill.
+ * @text: file contents.
+ * @size: size of @text.
+ *
+ * Handles data, end of file, extended segment and extended linear
+ * address records. Segments come out sorted and merged, overlapping
+ * records are resolved in favour of the later one. On error
+ * @image->line holds the offending line.
+ */
+int mcs51_load_ihex(struct mcs51_image *image, const char *text, size_t size)
+{
+    const char *end = text + size, *walk, *line;
+    uint32_t base = 0, addr;
+    unsigned int count, type, index, value;
+    uint8_t *data, sum;
+    int retval;
+
+    if ((retval = image_setup(image, size)))
+        return retval;
+
+    for (walk = text; walk < end; walk = line + 1) {
+        ++image->line;
+        if (!(line = memchr(walk, '\n', end - walk)))
+            line = end;
+
+        while (walk < line && (*walk == ' ' || *walk == '\t'))
+            ++walk;
+        if (walk == line || (walk + 1 == line && *walk == '\r'))
+            continue;
+
+        if (*walk++ != ':' || line - walk < 10)
+            return image_finish(image, -EINVAL);
+
+        if ((count = hex_byte(walk)) > 0xff || line - walk < count * 2 + 10)
+            return image_finish(image, -EINVAL);
+
+        addr = hex_byte(walk + 2);
+        value = hex_byte(walk + 4);
+        type = hex_byte(walk + 6);
+        if ((addr | value | type) > 0xff)
+            return image_finish(image, -EINVAL);
+        addr = addr << 8 | value;
+
+        sum = count + (addr >> 8) + addr + type;
+        walk += 8;
+
+        data = NULL;
+        if (type == 0x00 && count && !(data = image_append(image, base + addr, count)))
+            return image_finish(image, -ENOMEM);
+
+        for (index = 0; index < count; ++index, walk += 2) {
+            if ((value = hex_byte(walk)) > 0xff)
+                return image_finish(image, -EINVAL);
+            if (data)
+                data[index] = value;
+            sum += value;
+        }
+
+        if ((value = hex_byte(walk)) > 0xff || (uint8_t)(sum + value))
+            return image_finish(image, -EINVAL);
+
+        switch (type) {
+            case 0x00: /* data */
+                break;
+
+            case 0x01: /* end of file */
+                return image_finish(image, 0);
+
+            case 0x02: /* extended segment address */
+                if (count != 2)
+                    return image_finish(image, -EINVAL);
+                base = (hex_byte(walk - 4) << 8 | hex_byte(walk - 2)) << 4;
+                break;
+
+            case 0x04: /* extended linear address */
+                if (count != 2)
+                    return image_finish(image, -EINVAL);
+                base = (hex_byte(walk - 4) << 8 | hex_byte(walk - 2)) << 16;
+                break;
+
+            case 0x03: case 0x05: /* start address */
+                break;
+
+            default:
+                return image_finish(image, -EINVAL);
+        }
+    }
+
+    return image_finish(image, 0);
+}
+
+/**
+ * mcs51_load_srec - parse a Motorola S-record file into a sparse image.
+ * @image: image to fill.
+ * @text: file contents.
+ * @size: size of @text.
+ *
+ * S1/S2/S3 data records are loaded, header, count and termination
+ * records are only checked. Segments are merged as for
+ * mcs51_load_ihex. On error @image->line holds the offending line.
+ */
+int mcs51_load_srec(struct mcs51_image *image, const char *text, size_t size)
+{
+    const char *end = text + size, *walk, *line;
+    unsigned int count, type, alen, index, value;
+    uint32_t addr;
+    uint8_t *data, sum;
+    int retval;
+
+    if ((retval = image_setup(image, size)))
+        return retval;
+
+    for (walk = text; walk < end; walk = line + 1) {
+        ++image->line;
+        if (!(line = memchr(walk, '\n', end - walk)))
+            line = end;
+
+        while (walk < line && (*walk == ' ' || *walk == '\t'))
+            ++walk;
+        if (walk == line || (walk + 1 == line && *walk == '\r'))
+            continue;
+
+        if (line - walk < 4 || walk[0] != 'S')
+            return image_finish(image, -EINVAL);
+
+        type = hex_value[(uint8_t)walk[1]];
+        if ((count = hex_byte(walk + 2)) > 0xff)
+            return image_finish(image, -EINVAL);
+        walk += 4;
+
+        switch (type) {
+            case 0: case 1: case 5: case 9:
+                alen = 2;
+                break;
+
+            case 2: case 6: case 8:
+                alen = 3;
+                break;
+
+            case 3: case 7:
+                alen = 4;
+                break;
+
+            default:
+                return image_finish(image, -EINVAL);
+        }
+
+        if (count < alen + 1 || line - walk < count * 2)
+            return image_finish(image, -EINVAL);
+
+        for (index = 0, addr = 0, sum = count; index < alen; ++index, walk += 2) {
+            if ((value = hex_byte(walk)) > 0xff)
+                return image_finish(image, -EINVAL);
+            addr = addr << 8 | value;
+            sum += value;
+        }
+
+        count -= alen + 1;
+        data = NULL;
+        if (type >= 1 && type <= 3 && count && !(data = image_append(image, addr, count)))
+            return image_finish(image, -ENOMEM);
+
+        for (index = 0; index < count; ++index, walk += 2) {
+            if ((value = hex_byte(walk)) > 0xff)
+                return image_finish(image, -EINVAL);
+            if (data)
+                data[index] = value;
+            sum += value;
+        }
+
+        if ((value = hex_byte(walk)) > 0xff || (uint8_t)~sum != value)
+            return image_finish(image, -EINVAL);
+
+        if (type >= 7)
+            return image_finish(image, 0);
+    }
+
+    return image_finish(image, 0);
+}
+
+void mcs51_image_release(struct mcs51_image *image)
+{
+    free(image->segs);
+    free(image->buf);
+    image->segs = NULL;
+    image->buf = NULL;
+    image->nr_segs = 0;
+}
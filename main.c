@@ -4,34 +4,1431 @@
  */
 
 #include "mcs51-disasm.h"
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <err.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <endian.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+static const struct option options[] = {
+    {"selftest",    no_argument,    NULL,   't'},
+    {"bench",       no_argument,    NULL,   'b'},
+    {"jobs",        required_argument, NULL, 'j'},
+    {"format",      required_argument, NULL, 'f'},
+    {"arch",        required_argument, NULL, 'a'},
+    {"recursive",   no_argument,    NULL,   'r'},
+    {"labels",      no_argument,    NULL,   'l'},
+    {"symbols",     required_argument, NULL, 's'},
+    {"fuzz",        required_argument, NULL, 'z'},
+    {"batch",       no_argument,    NULL,   'B'},
+    {"output",      required_argument, NULL, 'o'},
+    {"cache",       required_argument, NULL, 'c'},
+    {"diff",        no_argument,    NULL,   'd'},
+    {"output-format", required_argument, NULL, 'O'},
+    {"xref",        required_argument, NULL, 'x'},
+    {"callgraph",   required_argument, NULL, 'g'},
+    {"query",       required_argument, NULL, 'q'},
+    {"stats",       no_argument,    NULL,   'S'},
+    {"help",        no_argument,    NULL,   'h'},
+    { }, /* NULL */
+};
+
+static void __attribute__((noreturn)) usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [option] file\n", prog);
+    fprintf(stderr, "       %s --batch [option] file|dir|@list...\n", prog);
+    fprintf(stderr, "       %s --diff [option] old new\n", prog);
+    fprintf(stderr, "Reads standard input when file is '-'.\n");
+    fprintf(stderr, "  -t, --selftest   verify the dispatch table and check the decoder\n");
+    fprintf(stderr, "                   against the reference for every opcode and operand\n");
+    fprintf(stderr, "  -b, --bench      compare printf and buffered output speed\n");
+    fprintf(stderr, "  -j, --jobs=N     disassemble on N threads\n");
+    fprintf(stderr, "  -f, --format=FMT input format: bin, ihex or srec\n");
+    fprintf(stderr, "                   (default: guessed from the file extension),\n");
+    fprintf(stderr, "                   overlapping ihex and srec records: the last wins\n");
+    fprintf(stderr, "  -a, --arch=CORE  instruction set: 8051 (default), ds390 for the\n");
+    fprintf(stderr, "                   24-bit contiguous mode or at89lp for its 0xa5\n");
+    fprintf(stderr, "                   prefixed /dptr instructions\n");
+    fprintf(stderr, "  -O, --output-format=FMT\n");
+    fprintf(stderr, "                   listing format: text (default), json lines, or\n");
+    fprintf(stderr, "                   bin for fixed-width struct mcs51_record entries\n");
+    fprintf(stderr, "  -r, --recursive  follow control flow from the reset and interrupt\n");
+    fprintf(stderr, "                   vectors and through bounded jump tables, list\n");
+    fprintf(stderr, "                   unreached bytes as data\n");
+    fprintf(stderr, "  -l, --labels     emit L_xxxx labels and symbolic branch targets\n");
+    fprintf(stderr, "  -s, --symbols=S  name SFR and bit operands, S is 8051, 8052 or a\n");
+    fprintf(stderr, "                   file of 'sfr|bit NAME ADDR' lines layered on top\n");
+    fprintf(stderr, "  -B, --batch      disassemble every operand in one process, -j sets\n");
+    fprintf(stderr, "                   the number of workers, @list names a file of paths\n");
+    fprintf(stderr, "  -o, --output=DIR with --batch, write DIR/<name>.lst (.jsonl, .rec)\n");
+    fprintf(stderr, "                   per file instead of one stream with file headers,\n");
+    fprintf(stderr, "                   <name> is the basename and must be unique\n");
+    fprintf(stderr, "  -c, --cache=DIR  reuse rendered 4 KiB blocks of the linear sweep\n");
+    fprintf(stderr, "                   from the cache in DIR, created when missing\n");
+    fprintf(stderr, "  -d, --diff       list the instructions that differ between two\n");
+    fprintf(stderr, "                   binary images as a unified diff, exits 0 when\n");
+    fprintf(stderr, "                   they are equal, 1 when they differ, 2 on trouble\n");
+    fprintf(stderr, "  -x, --xref=FILE  write the cross-reference index of the image to FILE\n");
+    fprintf(stderr, "  -g, --callgraph=FMT\n");
+    fprintf(stderr, "                   write the call graph as dot or json\n");
+    fprintf(stderr, "  -q, --query=KIND:ADDR\n");
+    fprintf(stderr, "                   list the call, jump, direct, bit or dptr references\n");
+    fprintf(stderr, "                   to ADDR, file may be an index written by --xref\n");
+    fprintf(stderr, "  -S, --stats      time the load, decode, format and write phases and\n");
+    fprintf(stderr, "                   print them with opcode and format counts at exit\n");
+    fprintf(stderr, "  -z, --fuzz=FILE  check every listing path on FILE, abort on any\n");
+    fprintf(stderr, "                   difference (for AFL: --fuzz @@)\n");
+    fprintf(stderr, "  -h, --help       display this message\n");
+    exit(1);
+}
+
+static int selftest(void)
+{
+    int errors;
+
+    errors = mcs51_dispatch_check();
+    fprintf(stderr, "dispatch: %s\n", errors ? "FAILED" : "passed");
+    errors += mcs51_selftest();
+
+    return errors ? 1 : 0;
+}
+
+enum input_format {
+    INPUT_AUTO,
+    INPUT_BIN,
+    INPUT_IHEX,
+    INPUT_SREC,
+};
+
+static enum input_format input_guess(const char *name)
+{
+    const char *ext;
+
+    if (!(ext = strrchr(name, '.')))
+        return INPUT_BIN;
+
+    if (!strcasecmp(ext, ".hex") || !strcasecmp(ext, ".ihx") ||
+        !strcasecmp(ext, ".ihex"))
+        return INPUT_IHEX;
+
+    if (!strcasecmp(ext, ".srec") || !strcasecmp(ext, ".s19") ||
+        !strcasecmp(ext, ".s28") || !strcasecmp(ext, ".s37") ||
+        !strcasecmp(ext, ".mot"))
+        return INPUT_SREC;
+
+    return INPUT_BIN;
+}
+
+static enum input_format input_parse(const char *name)
+{
+    if (!strcmp(name, "bin"))
+        return INPUT_BIN;
+    if (!strcmp(name, "ihex"))
+        return INPUT_IHEX;
+    if (!strcmp(name, "srec"))
+        return INPUT_SREC;
+    errx(-1, "unknown input format: %s", name);
+}
+
+static enum mcs51_output output_parse(const char *name)
+{
+    if (!strcmp(name, "text"))
+        return MCS51_OUTPUT_TEXT;
+    if (!strcmp(name, "json"))
+        return MCS51_OUTPUT_JSON;
+    if (!strcmp(name, "bin"))
+        return MCS51_OUTPUT_BIN;
+    errx(-1, "unknown output format: %s", name);
+}
+
+/* Slurp a text image that cannot be mapped */
+static char *input_read(int fd, size_t *size)
+{
+    size_t len = 0, max = 1UL << 16;
+    char *buf = NULL;
+    ssize_t retval;
+
+    do {
+        if (len == max || !buf) {
+            max *= 2;
+            if (!(buf = realloc(buf, max)))
+                err(-1, "input alloc err");
+        }
+        if ((retval = read(fd, buf + len, max - len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            err(-1, "input read err");
+        }
+        len += retval;
+    } while (retval);
+
+    *size = len;
+    return buf;
+}
+
+/* Fault a mapping in so --stats charges page-in I/O to the load phase */
+static void input_prefault(const char *data, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE), offset;
+    volatile char sink = 0;
+
+    for (offset = 0; offset < size; offset += page)
+        sink += data[offset];
+    (void)sink;
+}
+
+static int fuzz(const char *name)
+{
+    size_t size;
+    char *data;
+    int fd;
+
+    if (!strcmp(name, "-"))
+        fd = STDIN_FILENO;
+    else if ((fd = open(name, O_RDONLY)) < 0)
+        err(-1, "Cannot open file: %s", name);
+
+    data = input_read(fd, &size);
+    close(fd);
+
+    mcs51_fuzz_one((const uint8_t *)data, size);
+    free(data);
+
+    return 0;
+}
+
+/* The data pointer, escaped instructions use the alternate one */
+static inline const char *bench_dptr(const struct mcs51_insn *insn)
+{
+    return insn->prefix ? "/dptr" : "dptr";
+}
+
+/**
+ * bench_print_insn - decode and print one instruction through printf.
+ * @data: instruction bytes.
+ * @len: number of valid bytes at @data, at least one.
+ *
+ * The printf based output path the listing used before the buffered
+ * emitter, kept as the baseline --bench measures against. Returns the
+ * instruction size.
+ */
+static int bench_print_insn(const uint8_t *data, size_t len)
+{
+    const struct mcs51_ops *ops;
+    struct mcs51_insn insn;
+
+    mcs51_decode(&insn, data, len, 0);
+    ops = insn.ops;
+
+    if (ops == NULL) {
+        printf("\tbyte\t\t0x%02x", insn.opcode);
+        return 1;
+    }
+
+    printf("\t%s", ops->name);
+
+    switch (ops->format) {
+        case MCS51_INS_NON:
+            break;
+
+        case MCS51_INS_A11:
+            printf("\t\t0x%03x", insn.addr16);
+            break;
+
+        case MCS51_INS_A16:
+            printf("\t\t0x%04x", insn.addr16);
+            break;
+
+        case MCS51_INS_A19:
+            printf("\t\t0x%05x", insn.addr24);
+            break;
+
+        case MCS51_INS_A24:
+            printf("\t\t0x%06x", insn.addr24);
+            break;
+
+        case MCS51_INS_ACC:
+            printf("\t\ta");
+            break;
+
+        case MCS51_INS_ACB:
+            printf("\t\tab");
+            break;
+
+        case MCS51_INS_ACR:
+            printf("\t\ta, %s", mcs51_reg_name[insn.reg]);
+            break;
+
+        case MCS51_INS_ATR:
+            printf("\t\ta, @%s", mcs51_treg_name[insn.reg]);
+            break;
+
+        case MCS51_INS_ACI:
+            printf("\t\ta, #0x%02x", insn.immed);
+            break;
+
+        case MCS51_INS_AIO:
+            printf("\t\ta, #0x%02x, 0x%02x", insn.immed, (uint8_t)insn.rel);
+            break;
+
+        case MCS51_INS_ACD:
+            printf("\t\ta, 0x%02x", insn.direct);
+            break;
+
+        case MCS51_INS_ADO:
+            printf("\t\ta, 0x%02x, 0x%02x", insn.direct, (uint8_t)insn.rel);
+            break;
+
+        case MCS51_INS_ATP:
+            printf("\t\ta, @%s", bench_dptr(&insn));
+            break;
+
+        case MCS51_INS_ATA:
+            printf("\t\ta, @a+%s", bench_dptr(&insn));
+            break;
+
+        case MCS51_INS_ATC:
+            printf("\t\ta, @a+pc");
+            break;
+
+        case MCS51_INS_REG:
+            printf("\t\t%s", mcs51_reg_name[insn.reg]);
+            break;
+
+        case MCS51_INS_REA:
+            printf("\t\t%s, a", mcs51_reg_name[insn.reg]);
+            break;
+
+        case MCS51_INS_REI:
+            printf("\t\t%s, #0x%02x", mcs51_reg_name[insn.reg], insn.immed);
+            break;
+
+        case MCS51_INS_RIO:
+            printf("\t\t%s, #0x%02x, 0x%02x", mcs51_reg_name[insn.reg], insn.immed, (uint8_t)insn.rel);
+            break;
+
+        case MCS51_INS_RED:
+            printf("\t\t%s, 0x%02x", mcs51_reg_name[insn.reg], insn.direct);
+            break;
+
+        case MCS51_INS_REO:
+            printf("\t\t%s, 0x%02x", mcs51_reg_name[insn.reg], (uint8_t)insn.rel);
+            break;
+
+        case MCS51_INS_DIR:
+            printf("\t\t0x%02x", insn.direct);
+            break;
+
+        case MCS51_INS_DIA:
+            printf("\t\t0x%02x, a", insn.direct);
+            break;
+
+        case MCS51_INS_DRE:
+            printf("\t\t0x%02x, %s", insn.direct, mcs51_reg_name[insn.reg]);
+            break;
+
+        case MCS51_INS_DTR:
+            printf("\t\t0x%02x, %s", insn.direct, mcs51_treg_name[insn.reg]);
+            break;
+
+        case MCS51_INS_DII:
+            printf("\t\t0x%02x, #0x%02x", insn.direct, insn.immed);
+            break;
+
+        case MCS51_INS_DID:
+            printf("\t\t0x%02x, 0x%02x", insn.direct, insn.direct2);
+            break;
+
+        case MCS51_INS_DIO:
+            printf("\t\t0x%02x, 0x%02x", insn.direct, (uint8_t)insn.rel);
+            break;
+
+        case MCS51_INS_PTR:
+            printf("\t\t%s", bench_dptr(&insn));
+            break;
+
+        case MCS51_INS_PTI:
+            printf("\t\t%s, 0x%02x", bench_dptr(&insn), insn.addr16 >> 8);
+            break;
+
+        case MCS51_INS_PTL:
+            printf("\t\tdptr, #0x%06x", insn.addr24);
+            break;
+
+        case MCS51_INS_BIT:
+            printf("\t\t0x%02x", insn.bit);
+            break;
+
+        case MCS51_INS_BIC:
+            printf("\t\t0x%02x, c", insn.bit);
+            break;
+
+        case MCS51_INS_BIO:
+            printf("\t\t0x%02x, 0x%02x", insn.bit, (uint8_t)insn.rel);
+            break;
+
+        case MCS51_INS_CON:
+            printf("\t\tc");
+            break;
+
+        case MCS51_INS_COB:
+            printf("\t\tc, 0x%02x", insn.bit);
+            break;
+
+        case MCS51_INS_COX:
+            printf("\t\tc, /0x%02x", insn.bit);
+            break;
+
+        case MCS51_INS_TRE:
+            printf("\t\t%s", mcs51_treg_name[insn.reg]);
+            break;
+
+        case MCS51_INS_TRA:
+            printf("\t\t%s, a", mcs51_treg_name[insn.reg]);
+            break;
+
+        case MCS51_INS_TRI:
+            printf("\t\t%s, #0x%02x", mcs51_treg_name[insn.reg], insn.immed);
+            break;
+
+        case MCS51_INS_TIO:
+            printf("\t\t%s, #0x%02x, 0x%02x", mcs51_treg_name[insn.reg], insn.immed, (uint8_t)insn.rel);
+            break;
+
+        case MCS51_INS_TRD:
+            printf("\t\t%s, 0x%02x", mcs51_treg_name[insn.reg], insn.direct);
+            break;
+
+        case MCS51_INS_TPA:
+            printf("\t\t@%s, a", bench_dptr(&insn));
+            break;
+
+        case MCS51_INS_TAD:
+            printf("\t\t@a+%s", bench_dptr(&insn));
+            break;
+
+        case MCS51_INS_TPI:
+            printf("\t\t@dptr, #0x%02x", insn.immed);
+            break;
+
+        case MCS51_INS_OFF:
+            printf("\t\t0x%02x", (uint8_t)insn.rel);
+            break;
+
+        default:
+            printf("\t\tundecoded operands, inst is 0x%04x", insn.opcode);
+            break;
+    }
+
+    return insn.size;
+}
+
+static void disasm_printf(const uint8_t *data, size_t size, uint32_t base)
+{
+    size_t offset;
+    int retval;
+
+    for (offset = 0; offset < size; offset += retval) {
+        printf("0x%04lx:", base + offset);
+        retval = bench_print_insn(data + offset, size - offset);
+        printf("\n");
+    }
+}
+
+static double bench_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(const struct mcs51_segment *segs, size_t nr_segs)
+{
+    struct mcs51_emit emit;
+    double start, best_printf, best_emit, time;
+    size_t index, size;
+    int null, saved, count;
+
+    if ((null = open("/dev/null", O_WRONLY)) < 0)
+        err(-1, "Cannot open /dev/null");
+
+    saved = dup(STDOUT_FILENO);
+    dup2(null, STDOUT_FILENO);
+    mcs51_emit_init(&emit, STDOUT_FILENO, MCS51_EMIT_SIZE);
+
+    for (index = size = 0; index < nr_segs; ++index)
+        size += segs[index].size;
+
+    for (count = 0, best_printf = best_emit = 1e9; count < 3; ++count) {
+        start = bench_clock();
+        for (index = 0; index < nr_segs; ++index)
+            disasm_printf(segs[index].data, segs[index].size, segs[index].addr);
+        fflush(stdout);
+        if ((time = bench_clock() - start) < best_printf)
+            best_printf = time;
+
+        start = bench_clock();
+        for (index = 0; index < nr_segs; ++index)
+            mcs51_emit_range(&emit, segs[index].data, segs[index].size,
+                             0, segs[index].size, segs[index].addr);
+        mcs51_emit_flush(&emit);
+        if ((time = bench_clock() - start) < best_emit)
+            best_emit = time;
+    }
+
+    mcs51_emit_exit(&emit);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(null);
+
+    fprintf(stderr, "printf:  %10.3f ms  %8.2f MB/s\n",
+            best_printf * 1e3, size / best_printf / 1e6);
+    fprintf(stderr, "emit:    %10.3f ms  %8.2f MB/s\n",
+            best_emit * 1e3, size / best_emit / 1e6);
+    fprintf(stderr, "speedup: %10.2fx\n", best_printf / best_emit);
+
+    return 0;
+}
+
+/**
+ * struct xref_config - cross-reference output requested.
+ * @index: path to write the index file to, NULL for none.
+ * @callgraph: "dot" or "json", NULL for no call graph.
+ * @queries: KIND:ADDR lookups in command line order.
+ * @nr_queries: number of @queries.
+ */
+struct xref_config {
+    const char *index;
+    const char *callgraph;
+    const char **queries;
+    size_t nr_queries;
+};
+
+/**
+ * struct disasm_config - how to disassemble an image.
+ * @format: input format.
+ * @jobs: number of threads for the linear sweep.
+ * @recursive: follow control flow instead of sweeping linearly.
+ * @labels: emit labels and symbolic branch targets.
+ * @sym: names for direct and bit operands, NULL for numbers only.
+ * @cache: rendered block cache for the linear sweep, NULL for none.
+ * @output: format of the listing.
+ */
+struct disasm_config {
+    enum input_format format;
+    unsigned int jobs;
+    bool recursive;
+    bool labels;
+    const struct mcs51_symbols *sym;
+    struct mcs51_cache *cache;
+    enum mcs51_output output;
+};
+
+static void symbols_option(struct mcs51_symbols **psym, const char *arg)
+{
+    unsigned long line;
+    size_t size;
+    char *text;
+    int fd, retval;
+
+    if (!*psym && !(*psym = calloc(1, sizeof(**psym))))
+        err(-1, "symbol table alloc err");
+
+    if (!mcs51_symbols_builtin(*psym, arg))
+        return;
+
+    if ((fd = open(arg, O_RDONLY)) < 0)
+        err(-1, "Cannot open symbol file: %s", arg);
+
+    text = input_read(fd, &size);
+    close(fd);
+
+    if ((retval = mcs51_symbols_load(*psym, text, size, &line)))
+        errx(-1, "%s:%lu: malformed symbol", arg, line);
+
+    free(text);
+}
+
+static void disasm_segments(const struct disasm_config *cfg, struct mcs51_emit *emit,
+                            const struct mcs51_segment *segs, size_t nr_segs)
+{
+    struct mcs51_listing listing;
+    struct mcs51_trace trace;
+    size_t index;
+
+    if (cfg->recursive) {
+        mcs51_trace_init(&trace, segs, nr_segs);
+        mcs51_trace_run(&trace);
+    }
+
+    if (cfg->labels) {
+        mcs51_listing_init(&listing);
+        if (cfg->recursive)
+            mcs51_listing_trace(&listing, &trace);
+        else
+            mcs51_listing_linear(&listing, segs, nr_segs);
+        mcs51_listing_label(&listing);
+        mcs51_listing_emit(&listing, emit);
+        mcs51_listing_release(&listing);
+    } else if (cfg->recursive) {
+        mcs51_trace_emit(&trace, emit);
+    } else if (cfg->cache) {
+        for (index = 0; index < nr_segs; ++index)
+            mcs51_emit_cached(cfg->cache, emit, segs[index].data, segs[index].size,
+                              segs[index].addr);
+    } else {
+        for (index = 0; index < nr_segs; ++index)
+            mcs51_emit_range(emit, segs[index].data, segs[index].size,
+                             0, segs[index].size, segs[index].addr);
+    }
+
+    if (cfg->recursive)
+        mcs51_trace_release(&trace);
+}
+
+/* More batch workers than this only contend for the file list */
+#define BATCH_WORKERS 64
+
+/**
+ * struct batch_worker - per-thread state reused from file to file.
+ * @batch: batch being worked on.
+ * @emit: output buffer, kept in memory for the combined stream.
+ * @buf: input buffer.
+ * @size: allocated size of @buf.
+ */
+struct batch_worker {
+    struct batch *batch;
+    struct mcs51_emit emit;
+    uint8_t *buf;
+    size_t size;
+};
+
+/**
+ * struct batch - a list of files disassembled by a worker pool.
+ * @cfg: how to disassemble each file.
+ * @outdir: directory for per-file listings, NULL for one combined
+ *          stream on standard output.
+ * @names: files to disassemble.
+ * @nr_names: number of @names.
+ * @next: next file to claim.
+ * @turn: next file to write to the combined stream.
+ * @failed: set once any file could not be disassembled.
+ */
+struct batch {
+    const struct disasm_config *cfg;
+    const char *outdir;
+    char **names;
+    size_t nr_names;
+    size_t next;
+    size_t turn;
+    bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void batch_add(char ***pnames, size_t *nr, size_t *max, char *name)
+{
+    if (*nr == *max) {
+        *max = *max ? *max * 2 : 64;
+        if (!(*pnames = realloc(*pnames, *max * sizeof(**pnames))))
+            err(-1, "batch list alloc err");
+    }
+
+    (*pnames)[(*nr)++] = name;
+}
+
+/* @dir/@name@suffix in a new allocation */
+static char *batch_path(const char *dir, const char *name, const char *suffix)
+{
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    char *path;
+
+    if (!(path = malloc(dlen + nlen + strlen(suffix) + 2)))
+        err(-1, "batch path alloc err");
+
+    memcpy(path, dir, dlen);
+    path[dlen] = '/';
+    memcpy(path + dlen + 1, name, nlen);
+    strcpy(path + dlen + 1 + nlen, suffix);
+
+    return path;
+}
+
+static int batch_name_cmp(const void *pa, const void *pb)
+{
+    return strcmp(*(char *const *)pa, *(char *const *)pb);
+}
+
+/* Regular files of a directory, in name order */
+static void batch_dir(char ***pnames, size_t *nr, size_t *max, const char *path)
+{
+    struct dirent *dent;
+    struct stat stat;
+    size_t first = *nr;
+    char *name;
+    DIR *dir;
+
+    if (!(dir = opendir(path)))
+        err(-1, "Cannot open directory: %s", path);
+
+    while ((dent = readdir(dir))) {
+        if (dent->d_name[0] == '.')
+            continue;
+        name = batch_path(path, dent->d_name, "");
+        if (lstat(name, &stat) || !S_ISREG(stat.st_mode)) {
+            free(name);
+            continue;
+        }
+        batch_add(pnames, nr, max, name);
+    }
+
+    closedir(dir);
+    qsort(*pnames + first, *nr - first, sizeof(**pnames), batch_name_cmp);
+}
+
+/* One path per line, blank lines and lines starting with '#' ignored */
+static void batch_manifest(char ***pnames, size_t *nr, size_t *max, const char *path)
+{
+    char *text, *walk, *line, *end;
+    size_t size;
+    int fd;
+
+    if (!strcmp(path, "-"))
+        fd = STDIN_FILENO;
+    else if ((fd = open(path, O_RDONLY)) < 0)
+        err(-1, "Cannot open manifest: %s", path);
+
+    text = input_read(fd, &size);
+    close(fd);
+
+    for (walk = text, end = text + size; walk < end; walk = line + 1) {
+        if (!(line = memchr(walk, '\n', end - walk)))
+            line = end;
+        if (line > walk && line[-1] == '\r')
+            line[-1] = '\0';
+        if (line < end)
+            *line = '\0';
+        if (walk == line || *walk == '#' || !*walk)
+            continue;
+        if (!(walk = strndup(walk, line - walk)))
+            err(-1, "batch list alloc err");
+        batch_add(pnames, nr, max, walk);
+    }
+
+    free(text);
+}
+
+/**
+ * batch_file - disassemble one file of a batch into the worker buffer.
+ * @worker: worker doing the file.
+ * @name: file to disassemble.
+ *
+ * The file is read into the reused input buffer rather than mapped.
+ * Problems are reported and the file skipped. Returns 0 on success.
+ */
+static int batch_file(struct batch_worker *worker, const char *name)
+{
+    const struct disasm_config *cfg = worker->batch->cfg;
+    struct mcs51_image image = { };
+    struct mcs51_segment single;
+    const struct mcs51_segment *segs;
+    enum input_format format;
+    size_t nr_segs, size;
+    struct stat stat;
+    ssize_t retval;
+    int fd;
+
+    if ((fd = open(name, O_RDONLY)) < 0) {
+        warn("Cannot open file: %s", name);
+        return -1;
+    }
+
+    if (fstat(fd, &stat) < 0 || !S_ISREG(stat.st_mode)) {
+        warnx("%s: not a regular file", name);
+        close(fd);
+        return -1;
+    }
+
+    if ((size_t)stat.st_size > worker->size) {
+        free(worker->buf);
+        worker->size = stat.st_size;
+        if (!(worker->buf = malloc(worker->size)))
+            err(-1, "batch input alloc err");
+    }
+
+    for (size = 0; size < (size_t)stat.st_size; size += retval) {
+        retval = pread(fd, worker->buf + size, stat.st_size - size, size);
+        if (retval < 0 && errno == EINTR)
+            retval = 0;
+        else if (retval <= 0)
+            break;
+    }
+    close(fd);
+
+    if (size != (size_t)stat.st_size) {
+        warnx("%s: short read", name);
+        return -1;
+    }
+
+    format = cfg->format == INPUT_AUTO ? input_guess(name) : cfg->format;
+    if (format == INPUT_BIN) {
+        single.addr = 0;
+        single.size = size;
+        single.data = worker->buf;
+        segs = &single;
+        nr_segs = 1;
+    } else {
+        if (format == INPUT_IHEX)
+            retval = mcs51_load_ihex(&image, (char *)worker->buf, size);
+        else
+            retval = mcs51_load_srec(&image, (char *)worker->buf, size);
+        if (retval == -EINVAL) {
+            warnx("%s:%lu: malformed record", name, image.line);
+            return -1;
+        } else if (retval) {
+            warnx("%s: load err: %s", name, strerror(-retval));
+            return -1;
+        }
+        segs = image.segs;
+        nr_segs = image.nr_segs;
+    }
+
+    disasm_segments(cfg, &worker->emit, segs, nr_segs);
+    mcs51_image_release(&image);
+
+    return 0;
+}
+
+static const char *const batch_suffix[] = {
+    [MCS51_OUTPUT_TEXT] = ".lst",
+    [MCS51_OUTPUT_JSON] = ".jsonl",
+    [MCS51_OUTPUT_BIN] = ".rec",
+};
+
+static const char *batch_base(const char *name)
+{
+    const char *base = strrchr(name, '/');
+
+    return base ? base + 1 : name;
+}
+
+static int batch_base_cmp(const void *pa, const void *pb)
+{
+    return strcmp(batch_base(*(char *const *)pa), batch_base(*(char *const *)pb));
+}
+
+/* Two operands with one basename would write the same listing file */
+static void batch_unique(const struct batch *batch)
+{
+    char **sorted;
+    size_t index;
+
+    if (!(sorted = malloc(batch->nr_names * sizeof(*sorted))))
+        err(-1, "batch list alloc err");
+    memcpy(sorted, batch->names, batch->nr_names * sizeof(*sorted));
+    qsort(sorted, batch->nr_names, sizeof(*sorted), batch_base_cmp);
+
+    for (index = 1; index < batch->nr_names; ++index) {
+        if (!batch_base_cmp(&sorted[index - 1], &sorted[index]))
+            errx(-1, "%s and %s would both be listed to %s/%s%s", sorted[index - 1],
+                 sorted[index], batch->outdir, batch_base(sorted[index]),
+                 batch_suffix[batch->cfg->output]);
+    }
+
+    free(sorted);
+}
+
+/*
+ * Per-file listings go to outdir/<basename> plus the format suffix.
+ * @path is filled with the listing path, to be freed by the caller.
+ */
+static int batch_output(const struct batch *batch, const char *name, char **path)
+{
+    int fd;
+
+    *path = batch_path(batch->outdir, batch_base(name), batch_suffix[batch->cfg->output]);
+
+    if ((fd = open(*path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        warn("Cannot create listing: %s", *path);
+
+    return fd;
+}
+
+/* Hand a finished listing to the combined stream in list order */
+static void batch_publish(struct batch_worker *worker, size_t index)
+{
+    struct batch *batch = worker->batch;
+
+    pthread_mutex_lock(&batch->lock);
+    while (batch->turn != index)
+        pthread_cond_wait(&batch->cond, &batch->lock);
+    pthread_mutex_unlock(&batch->lock);
+
+    worker->emit.fd = STDOUT_FILENO;
+    mcs51_emit_flush(&worker->emit);
+    worker->emit.fd = -1;
+
+    pthread_mutex_lock(&batch->lock);
+    batch->turn++;
+    pthread_cond_broadcast(&batch->cond);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void *batch_worker(void *pdata)
+{
+    struct batch_worker *worker = pdata;
+    struct batch *batch = worker->batch;
+    const char *name;
+    char *path = NULL;
+    size_t index;
+    bool failed;
+    int fd = -1;
+
+    while ((index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->nr_names) {
+        name = batch->names[index];
+        worker->emit.len = 0;
+
+        if (batch->outdir) {
+            if ((fd = batch_output(batch, name, &path)) < 0) {
+                __atomic_store_n(&batch->failed, true, __ATOMIC_RELAXED);
+                free(path);
+                continue;
+            }
+            worker->emit.fd = fd;
+            mcs51_emit_begin(&worker->emit);
+        } else {
+            mcs51_emit_file(&worker->emit, name);
+        }
+
+        if ((failed = batch_file(worker, name))) {
+            __atomic_store_n(&batch->failed, true, __ATOMIC_RELAXED);
+            worker->emit.len = 0;
+        }
+
+        if (batch->outdir) {
+            mcs51_emit_flush(&worker->emit);
+            worker->emit.fd = -1;
+            close(fd);
+            /* no empty or partial listing is left behind */
+            if (failed)
+                unlink(path);
+            free(path);
+        } else {
+            batch_publish(worker, index);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * disasm_batch - disassemble a list of files in one process.
+ * @cfg: how to disassemble each file, up to @cfg->jobs workers share the list.
+ * @outdir: directory for per-file listings, NULL for one combined stream.
+ * @args: file operands, "@file" for a manifest, directories for their files.
+ * @nr_args: number of @args.
+ */
+static int disasm_batch(const struct disasm_config *cfg, const char *outdir,
+                        char **args, int nr_args)
+{
+    struct batch batch = {
+        .cfg = cfg,
+        .outdir = outdir,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+    };
+    struct batch_worker *workers;
+    pthread_t *tids;
+    struct stat stat;
+    size_t max = 0, index;
+    unsigned int count, jobs;
+    int retval;
+
+    if (cfg->output == MCS51_OUTPUT_BIN && !outdir)
+        errx(-1, "binary batch output needs a directory (-o)");
+
+    for (retval = 0; retval < nr_args; ++retval) {
+        if (args[retval][0] == '@')
+            batch_manifest(&batch.names, &batch.nr_names, &max, args[retval] + 1);
+        else if (!lstat(args[retval], &stat) && S_ISDIR(stat.st_mode))
+            batch_dir(&batch.names, &batch.nr_names, &max, args[retval]);
+        else if (!(args[retval] = strdup(args[retval])))
+            err(-1, "batch list alloc err");
+        else
+            batch_add(&batch.names, &batch.nr_names, &max, args[retval]);
+    }
+
+    if (outdir)
+        batch_unique(&batch);
+
+    jobs = cfg->jobs;
+    if (jobs > batch.nr_names)
+        jobs = batch.nr_names;
+    if (jobs > BATCH_WORKERS)
+        jobs = BATCH_WORKERS;
+    if (!jobs)
+        jobs = 1;
+
+    workers = calloc(jobs, sizeof(*workers));
+    tids = calloc(jobs, sizeof(*tids));
+    if (!workers || !tids)
+        err(-1, "batch worker alloc err");
+
+    for (count = 0; count < jobs; ++count) {
+        workers[count].batch = &batch;
+        mcs51_emit_init(&workers[count].emit, -1, MCS51_EMIT_SIZE);
+        workers[count].emit.sym = cfg->sym;
+        workers[count].emit.output = cfg->output;
+    }
+
+    for (count = 1; count < jobs; ++count) {
+        if ((retval = pthread_create(&tids[count], NULL, batch_worker, &workers[count])))
+            errx(-1, "batch worker create err: %s", strerror(retval));
+    }
+
+    batch_worker(&workers[0]);
+
+    for (count = 0; count < jobs; ++count) {
+        if (count)
+            pthread_join(tids[count], NULL);
+        mcs51_emit_exit(&workers[count].emit);
+        free(workers[count].buf);
+    }
+
+    for (index = 0; index < batch.nr_names; ++index)
+        free(batch.names[index]);
+    free(batch.names);
+    free(workers);
+    free(tids);
+
+    return batch.failed ? 1 : 0;
+}
+
+/* Exit status of --diff when the images cannot be compared, as for diff(1) */
+#define DIFF_TROUBLE 2
+
+/* Map a whole binary image, or read it when it cannot be mapped */
+static void *input_map(const char *name, size_t *size)
+{
+    struct stat stat;
+    void *data;
+    int fd;
+
+    if (!strcmp(name, "-"))
+        fd = STDIN_FILENO;
+    else if ((fd = open(name, O_RDONLY)) < 0)
+        err(DIFF_TROUBLE, "Cannot open file: %s", name);
+
+    if (fstat(fd, &stat) < 0)
+        err(DIFF_TROUBLE, "file fstat err");
+
+    if (!S_ISREG(stat.st_mode)) {
+        data = input_read(fd, size);
+    } else if (!(*size = stat.st_size)) {
+        data = NULL;
+    } else {
+        data = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+            err(DIFF_TROUBLE, "file mmap err");
+    }
+
+    close(fd);
+    return data;
+}
+
+static int disasm_diff(const struct disasm_config *cfg, const char *old_name,
+                       const char *new_name)
+{
+    struct mcs51_segment old = { }, new = { };
+    struct mcs51_emit emit;
+    unsigned long hunks;
+
+    if ((cfg->format != INPUT_AUTO && cfg->format != INPUT_BIN) ||
+        (cfg->format == INPUT_AUTO && (input_guess(old_name) != INPUT_BIN ||
+                                       input_guess(new_name) != INPUT_BIN)))
+        errx(DIFF_TROUBLE, "diff needs binary images");
+
+    if (cfg->recursive || cfg->labels)
+        errx(DIFF_TROUBLE, "diff works on the linear sweep only");
+
+    if (cfg->output != MCS51_OUTPUT_TEXT)
+        errx(DIFF_TROUBLE, "diff writes text only");
+
+    old.data = input_map(old_name, &old.size);
+    new.data = input_map(new_name, &new.size);
+
+    mcs51_emit_init(&emit, STDOUT_FILENO, MCS51_EMIT_SIZE);
+    emit.sym = cfg->sym;
+    hunks = mcs51_emit_diff(&emit, &old, &new, old_name, new_name);
+    mcs51_emit_exit(&emit);
+
+    return hunks ? 1 : 0;
+}
+
+/* Parse a query address, SFR and bit names are accepted with symbols */
+static uint32_t xref_query_addr(const struct disasm_config *cfg, enum mcs51_xref_kind kind,
+                                const char *arg)
+{
+    const char (*names)[MCS51_SYMBOL_LEN] = NULL;
+    unsigned int index;
+    char *end;
+    unsigned long addr;
+
+    addr = strtoul(arg, &end, 0);
+    if (*arg && !*end)
+        return addr;
+
+    if (cfg->sym)
+        names = kind == MCS51_XREF_BIT ? cfg->sym->bit :
+                kind == MCS51_XREF_DIRECT ? cfg->sym->direct : NULL;
+
+    for (index = 0; names && index < 256; ++index)
+        if (!strcasecmp(arg, names[index]))
+            return index;
+
+    errx(-1, "bad query address: %s", arg);
+}
+
+/*
+ * Answer the queries and write the index and call graph. Each reference
+ * is one "from:\tkind\tto" line. Returns 1 when no query matched, like grep.
+ */
+static int disasm_xref(const struct disasm_config *cfg, const struct xref_config *xcfg,
+                       struct mcs51_xref *xref)
+{
+    const struct mcs51_xref_entry *entry;
+    enum mcs51_xref_kind kind;
+    struct mcs51_emit emit;
+    size_t index, count, found = 0;
+    char name[16], *addr, *buf, *walk;
+    int fd;
+
+    if (xcfg->index) {
+        if ((fd = open(xcfg->index, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+            err(-1, "Cannot open file: %s", xcfg->index);
+        mcs51_emit_init(&emit, fd, MCS51_EMIT_SIZE);
+        mcs51_xref_save(xref, &emit);
+        mcs51_emit_exit(&emit);
+        if (close(fd))
+            err(-1, "%s: close err", xcfg->index);
+    }
+
+    mcs51_emit_init(&emit, STDOUT_FILENO, MCS51_EMIT_SIZE);
+
+    if (xcfg->callgraph)
+        mcs51_xref_callgraph(xref, &emit, !strcmp(xcfg->callgraph, "json"));
+
+    for (index = 0; index < xcfg->nr_queries; ++index) {
+        if (!(addr = strchr(xcfg->queries[index], ':')) ||
+            addr - xcfg->queries[index] >= (long)sizeof(name))
+            errx(-1, "bad query: %s", xcfg->queries[index]);
+        memcpy(name, xcfg->queries[index], addr - xcfg->queries[index]);
+        name[addr - xcfg->queries[index]] = '\0';
+        if ((kind = mcs51_xref_kind(name)) == MCS51_XREF_KINDS)
+            errx(-1, "unknown reference kind: %s", name);
+
+        entry = mcs51_xref_find(xref, kind, xref_query_addr(cfg, kind, addr + 1), &count);
+        for (found += count; count--; ++entry) {
+            walk = buf = mcs51_emit_reserve(&emit, 48);
+            walk += mcs51_format_addr(walk, le32toh(entry->from));
+            walk += sprintf(walk, ":\t%s\t", name);
+            walk += mcs51_format_addr(walk, le32toh(entry->to));
+            *walk++ = '\n';
+            emit.len += walk - buf;
+        }
+    }
+
+    mcs51_emit_exit(&emit);
+    return xcfg->nr_queries && !found ? 1 : 0;
+}
+
 int main(int argc, char *argv[])
 {
+    struct disasm_config cfg = {
+        .format = INPUT_AUTO,
+        .jobs = 1,
+    };
+    struct mcs51_symbols *sym = NULL;
+    struct mcs51_image image = { };
+    struct mcs51_segment single;
+    const struct mcs51_segment *segs;
+    struct mcs51_emit emit;
     struct stat stat;
+    size_t nr_segs, size, index;
+    const char *outdir = NULL, *cachedir = NULL;
+    struct mcs51_cache cache;
+    struct xref_config xcfg = { };
+    struct mcs51_xref xref;
+    struct mcs51_trace trace;
+    char *end;
+    long jobs;
     int fd, retval;
-    void *data, *curr;
+    bool bench_mode = false, batch_mode = false, diff_mode = false, xref_mode;
+    struct mcs51_stats stats = { };
+    bool stats_mode = false;
+    double clock = 0;
+    void *data;
 
-    if ((fd = open(argv[1], O_RDONLY)) < 0)
-        err(-1, "Cannot open file: %s", argv[1]);
+    while ((retval = getopt_long(argc, argv, "tbj:f:a:O:rls:z:Bo:c:dx:g:q:Sh", options, NULL)) != -1) {
+        switch (retval) {
+            case 't':
+                return selftest();
+
+            case 'b':
+                bench_mode = true;
+                break;
+
+            case 'j':
+                jobs = strtol(optarg, &end, 0);
+                if (*end || jobs < 1 || jobs > INT_MAX)
+                    usage(argv[0]);
+                cfg.jobs = jobs;
+                break;
+
+            case 'f':
+                cfg.format = input_parse(optarg);
+                break;
+
+            case 'a':
+                if (mcs51_variant_select(optarg))
+                    errx(-1, "unknown core: %s", optarg);
+                break;
+
+            case 'O':
+                cfg.output = output_parse(optarg);
+                break;
+
+            case 'r':
+                cfg.recursive = true;
+                break;
+
+            case 'l':
+                cfg.labels = true;
+                break;
+
+            case 's':
+                symbols_option(&sym, optarg);
+                cfg.sym = sym;
+                break;
+
+            case 'z':
+                return fuzz(optarg);
+
+            case 'B':
+                batch_mode = true;
+                break;
+
+            case 'o':
+                outdir = optarg;
+                break;
+
+            case 'c':
+                cachedir = optarg;
+                break;
+
+            case 'd':
+                diff_mode = true;
+                break;
+
+            case 'x':
+                xcfg.index = optarg;
+                break;
+
+            case 'g':
+                if (strcmp(optarg, "dot") && strcmp(optarg, "json"))
+                    errx(-1, "unknown call graph format: %s", optarg);
+                xcfg.callgraph = optarg;
+                break;
+
+            case 'q':
+                xcfg.queries = realloc(xcfg.queries, (xcfg.nr_queries + 1) *
+                                       sizeof(*xcfg.queries));
+                if (!xcfg.queries)
+                    err(-1, "query alloc err");
+                xcfg.queries[xcfg.nr_queries++] = optarg;
+                break;
+
+            case 'S':
+                stats_mode = true;
+                break;
+
+            case 'h': default:
+                usage(argv[0]);
+        }
+    }
+
+    xref_mode = xcfg.index || xcfg.callgraph || xcfg.nr_queries;
+
+    if (optind >= argc)
+        usage(argv[0]);
+
+    if (xref_mode && (diff_mode || batch_mode || bench_mode))
+        errx(-1, "cross-references work on a single image");
+
+    if (stats_mode && (diff_mode || batch_mode || bench_mode || xref_mode || cachedir ||
+                       cfg.recursive || cfg.labels || cfg.jobs > 1))
+        errx(-1, "stats work on the serial linear sweep of a single image");
+
+    /* batch workers each sweep one file, so there -j and the cache combine */
+    if (cachedir && (diff_mode || bench_mode || xref_mode || cfg.recursive || cfg.labels ||
+                     (cfg.jobs > 1 && !batch_mode)))
+        errx(-1, "the cache works on the serial linear sweep");
+
+    if (diff_mode) {
+        if (argc - optind != 2)
+            errx(DIFF_TROUBLE, "diff needs an old and a new image");
+        retval = disasm_diff(&cfg, argv[optind], argv[optind + 1]);
+        free(sym);
+        return retval;
+    }
+
+    if (cachedir) {
+        if ((retval = mcs51_cache_open(&cache, cachedir, cfg.sym)))
+            errx(-1, "%s: cache open err: %s", cachedir, strerror(-retval));
+        cfg.cache = &cache;
+    }
+
+    if (batch_mode) {
+        if (bench_mode)
+            errx(-1, "bench does not combine with batch");
+        retval = disasm_batch(&cfg, outdir, argv + optind, argc - optind);
+        if (cfg.cache)
+            mcs51_cache_close(cfg.cache);
+        free(sym);
+        return retval;
+    }
+
+    if (stats_mode)
+        clock = mcs51_stats_clock();
+
+    if (!strcmp(argv[optind], "-"))
+        fd = STDIN_FILENO;
+    else if ((fd = open(argv[optind], O_RDONLY)) < 0)
+        err(-1, "Cannot open file: %s", argv[optind]);
 
     if ((retval = fstat(fd, &stat)) < 0)
         err(retval, "file fstat err");
 
-    curr = data = mmap(NULL, stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
-    if (data == MAP_FAILED)
-        err(-1, "file mmap err");
+    if (cfg.format == INPUT_AUTO)
+        cfg.format = input_guess(argv[optind]);
 
-    do {
-        printf("0x%04lx:", curr - data);
-        retval = print_insn_mcs51(curr);
-        printf("\n");
-        curr += retval;
-    } while ((stat.st_size -= retval));
+    if (cfg.format == INPUT_BIN && !cfg.recursive && !cfg.labels && !cfg.cache &&
+        !xref_mode && !stats_mode && !S_ISREG(stat.st_mode)) {
+        if (bench_mode || cfg.jobs > 1)
+            errx(-1, "bench and jobs need a regular file");
+        mcs51_emit_init(&emit, STDOUT_FILENO, MCS51_EMIT_SIZE);
+        emit.sym = cfg.sym;
+        emit.output = cfg.output;
+        mcs51_emit_begin(&emit);
+        mcs51_emit_stream(&emit, fd);
+        mcs51_emit_exit(&emit);
+        return 0;
+    }
+
+    if (!S_ISREG(stat.st_mode)) {
+        data = input_read(fd, &size);
+    } else if (!(size = stat.st_size)) {
+        return 0;
+    } else {
+        data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+            err(-1, "file mmap err");
+        if (stats_mode)
+            input_prefault(data, size);
+    }
+
+    /* an index written by --xref answers without decoding anything */
+    if (xref_mode && !mcs51_xref_load(&xref, data, size)) {
+        retval = disasm_xref(&cfg, &xcfg, &xref);
+        free(xcfg.queries);
+        free(sym);
+        return retval;
+    }
+
+    if (cfg.format == INPUT_BIN) {
+        single.addr = 0;
+        single.size = size;
+        single.data = data;
+        segs = &single;
+        nr_segs = 1;
+    } else {
+        if (cfg.format == INPUT_IHEX)
+            retval = mcs51_load_ihex(&image, data, size);
+        else
+            retval = mcs51_load_srec(&image, data, size);
+        if (retval == -EINVAL)
+            errx(-1, "%s:%lu: malformed record", argv[optind], image.line);
+        else if (retval)
+            errx(-1, "%s: load err: %s", argv[optind], strerror(-retval));
+        segs = image.segs;
+        nr_segs = image.nr_segs;
+    }
+
+    if (bench_mode)
+        return bench(segs, nr_segs);
+
+    if (stats_mode) {
+        stats.phase[MCS51_PHASE_LOAD] = mcs51_stats_clock() - clock;
+        mcs51_emit_init(&emit, STDOUT_FILENO, MCS51_EMIT_SIZE);
+        emit.sym = cfg.sym;
+        emit.output = cfg.output;
+        mcs51_emit_begin(&emit);
+        for (index = 0; index < nr_segs; ++index)
+            mcs51_stats_range(&stats, &emit, segs[index].data, segs[index].size,
+                              0, segs[index].size, segs[index].addr);
+        mcs51_stats_flush(&stats, &emit);
+        mcs51_emit_exit(&emit);
+        mcs51_stats_report(&stats);
+        mcs51_image_release(&image);
+        free(sym);
+        return 0;
+    }
+
+    if (xref_mode) {
+        if (cfg.recursive) {
+            mcs51_trace_init(&trace, segs, nr_segs);
+            mcs51_trace_run(&trace);
+        }
+        mcs51_xref_build(&xref, segs, nr_segs, cfg.recursive ? &trace : NULL);
+        if (cfg.recursive)
+            mcs51_trace_release(&trace);
+        retval = disasm_xref(&cfg, &xcfg, &xref);
+        mcs51_xref_release(&xref);
+        mcs51_image_release(&image);
+        free(xcfg.queries);
+        free(sym);
+        return retval;
+    }
+
+    mcs51_emit_init(&emit, STDOUT_FILENO, MCS51_EMIT_SIZE);
+    emit.sym = cfg.sym;
+    emit.output = cfg.output;
+    mcs51_emit_begin(&emit);
+
+    if (cfg.jobs > 1 && !cfg.recursive && !cfg.labels && !cfg.cache) {
+        mcs51_emit_flush(&emit);
+        for (index = 0; index < nr_segs; ++index)
+            mcs51_disasm_parallel(STDOUT_FILENO, segs[index].data, segs[index].size,
+                                  segs[index].addr, cfg.jobs, cfg.sym, cfg.output);
+    } else {
+        disasm_segments(&cfg, &emit, segs, nr_segs);
+    }
+
+    mcs51_emit_exit(&emit);
 
+    if (cfg.cache)
+        mcs51_cache_close(cfg.cache);
+    mcs51_image_release(&image);
+    free(sym);
     return 0;
 }
@@ -5,211 +5,869 @@
 
 #include "mcs51-disasm.h"
 #include "opcode.h"
+#include <string.h>
+#include <errno.h>
 
-int print_insn_mcs51(uint8_t *data)
+const unsigned int mcs51_nr_table = ARRAY_SIZE(mcs51_table);
+const unsigned int mcs51_nr_ext_table = ARRAY_SIZE(mcs51_ext_table);
+const unsigned int mcs51_nr_variants = ARRAY_SIZE(mcs51_variant_table);
+
+/*
+ * Dispatch of the selected core. Every variant gets its own tables built
+ * once at startup, selecting one copies them here, so the decoder does a
+ * single lookup per instruction whatever the core.
+ */
+static const struct mcs51_ops *mcs51_dispatch[256];
+static const struct mcs51_ops *mcs51_escape_dispatch[256];
+static unsigned int mcs51_variant;
+
+static const struct mcs51_ops *mcs51_variant_dispatch
+    [ARRAY_SIZE(mcs51_variant_table)][2][256];
+
+static const struct mcs51_ops *mcs51_scan(const struct mcs51_ops *table, unsigned int count,
+                                          uint8_t opcode, const struct mcs51_ops *ops)
 {
-    const struct mcs51_ops *walk, *ops;
-    unsigned int count, tmp;
+    const struct mcs51_ops *walk;
+    unsigned int tmp;
 
-    for (count = 0, ops = NULL; count < ARRAY_SIZE(mcs51_table); ++count) {
-        walk = &mcs51_table[count];
-        if ((walk->opcode ^ data[0]) & walk->mask)
+    for (walk = table; walk < table + count; ++walk) {
+        if ((walk->opcode ^ opcode) & walk->mask)
             continue;
 
-        tmp = data[0] & walk->reg;
+        tmp = opcode & walk->reg;
         if (tmp < walk->min || walk->max < tmp)
             continue;
 
         ops = walk;
     }
 
+    return ops;
+}
+
+/**
+ * mcs51_lookup - find the table entry of an opcode by linear scan.
+ * @variant: core to look up in.
+ * @opcode: first byte of the instruction.
+ *
+ * The last matching entry of mcs51_table and then the overlay of the
+ * core wins. This is the reference rule that mcs51_dispatch is
+ * generated from.
+ */
+static const struct mcs51_ops *mcs51_lookup(const struct mcs51_variant *variant,
+                                            uint8_t opcode)
+{
+    const struct mcs51_ops *ops;
+
+    ops = mcs51_scan(mcs51_table, ARRAY_SIZE(mcs51_table), opcode, NULL);
+    return mcs51_scan(mcs51_ext_table + variant->overlay, variant->nr_overlay, opcode, ops);
+}
+
+/* Entry of the byte following the escape of @variant */
+static const struct mcs51_ops *mcs51_lookup_escape(const struct mcs51_variant *variant,
+                                                   uint8_t opcode)
+{
+    return mcs51_scan(mcs51_ext_table + variant->escapes, variant->nr_escapes, opcode, NULL);
+}
+
+static void __attribute__((constructor)) mcs51_dispatch_init(void)
+{
+    const struct mcs51_variant *variant;
+    unsigned int index, opcode;
+
+    for (index = 0; index < ARRAY_SIZE(mcs51_variant_table); ++index) {
+        variant = &mcs51_variant_table[index];
+        for (opcode = 0; opcode < 256; ++opcode) {
+            mcs51_variant_dispatch[index][0][opcode] = mcs51_lookup(variant, opcode);
+            mcs51_variant_dispatch[index][1][opcode] = mcs51_lookup_escape(variant, opcode);
+        }
+    }
+
+    mcs51_variant_select(mcs51_variant_table[0].name);
+}
+
+/**
+ * mcs51_variant_select - switch the decoder to another core.
+ * @name: name of the core, see mcs51_variant_table.
+ *
+ * Not thread safe, select the core before decoding starts.
+ * Returns 0, or -ENOENT for an unknown core.
+ */
+int mcs51_variant_select(const char *name)
+{
+    unsigned int index;
+
+    for (index = 0; index < ARRAY_SIZE(mcs51_variant_table); ++index) {
+        if (strcmp(name, mcs51_variant_table[index].name))
+            continue;
+
+        memcpy(mcs51_dispatch, mcs51_variant_dispatch[index][0], sizeof(mcs51_dispatch));
+        memcpy(mcs51_escape_dispatch, mcs51_variant_dispatch[index][1],
+               sizeof(mcs51_escape_dispatch));
+        mcs51_variant = index;
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+const char *mcs51_variant_name(void)
+{
+    return mcs51_variant_table[mcs51_variant].name;
+}
+
+/*
+ * The escaped instruction at @data, or NULL. Only reached for bytes that
+ * do not decode on their own, so cores without an escape pay nothing.
+ */
+static inline const struct mcs51_ops *mcs51_escaped(const uint8_t *data, size_t len)
+{
+    const struct mcs51_ops *ops;
+
+    if (len < 2 || !mcs51_variant_table[mcs51_variant].nr_escapes ||
+        data[0] != mcs51_variant_table[mcs51_variant].escape)
+        return NULL;
+
+    ops = mcs51_escape_dispatch[data[1]];
+    return ops && ops->size < len ? ops : NULL;
+}
+
+/**
+ * mcs51_insn_size - instruction length without a full decode.
+ * @data: instruction bytes.
+ * @len: number of valid bytes at @data, at least one.
+ *
+ * Agrees with the length mcs51_decode returns for the same bytes.
+ */
+unsigned int mcs51_insn_size(const uint8_t *data, size_t len)
+{
+    const struct mcs51_ops *ops = mcs51_dispatch[data[0]];
+
+    if (ops && ops->size <= len)
+        return ops->size;
+
+    ops = mcs51_escaped(data, len);
+    return ops ? ops->size + 1 : 1;
+}
+
+/**
+ * mcs51_ops_index - position of an entry in mcs51_table.
+ * @ops: entry returned by the decoder.
+ *
+ * Entries of mcs51_ext_table are numbered after those of mcs51_table.
+ */
+unsigned int mcs51_ops_index(const struct mcs51_ops *ops)
+{
+    if (ops >= mcs51_ext_table && ops < mcs51_ext_table + ARRAY_SIZE(mcs51_ext_table))
+        return ARRAY_SIZE(mcs51_table) + (ops - mcs51_ext_table);
+    return ops - mcs51_table;
+}
+
+/**
+ * mcs51_dispatch_check - verify the dispatch tables of every core.
+ *
+ * The tables are built through mcs51_lookup, so they are compared with
+ * the last-match-wins scan written out again here: mcs51_table, then the
+ * overlay of the core, and the escape table for the escaped byte. Also
+ * checks that no escape byte decodes on its own. Returns the number of
+ * mismatches.
+ */
+int mcs51_dispatch_check(void)
+{
+    const struct mcs51_variant *variant;
+    const struct mcs51_ops *walk, *end, *expect[2];
+    unsigned int index, span, opcode, tmp;
+    int errors = 0;
+
+    for (index = 0; index < ARRAY_SIZE(mcs51_variant_table); ++index) {
+        variant = &mcs51_variant_table[index];
+        for (opcode = 0; opcode < 256; ++opcode) {
+            expect[0] = expect[1] = NULL;
+            for (span = 0; span < 3; ++span) {
+                if (span == 0) {
+                    walk = mcs51_table;
+                    end = walk + ARRAY_SIZE(mcs51_table);
+                } else if (span == 1) {
+                    walk = mcs51_ext_table + variant->overlay;
+                    end = walk + variant->nr_overlay;
+                } else {
+                    walk = mcs51_ext_table + variant->escapes;
+                    end = walk + variant->nr_escapes;
+                }
+
+                for (; walk < end; ++walk) {
+                    tmp = opcode & walk->reg;
+                    if (!((walk->opcode ^ opcode) & walk->mask) &&
+                        walk->min <= tmp && tmp <= walk->max)
+                        expect[span == 2] = walk;
+                }
+            }
+
+            if (mcs51_variant_dispatch[index][0][opcode] != expect[0]) {
+                fprintf(stderr, "%s: dispatch mismatch at opcode 0x%02x\n",
+                        variant->name, opcode);
+                ++errors;
+            }
+            if (mcs51_variant_dispatch[index][1][opcode] != expect[1]) {
+                fprintf(stderr, "%s: escape dispatch mismatch at opcode 0x%02x\n",
+                        variant->name, opcode);
+                ++errors;
+            }
+        }
+
+        /* an escape byte must not decode on its own */
+        if (variant->nr_escapes && mcs51_variant_dispatch[index][0][variant->escape]) {
+            fprintf(stderr, "%s: escape 0x%02x is an opcode\n", variant->name,
+                    variant->escape);
+            ++errors;
+        }
+    }
+
+    return errors;
+}
+
+static unsigned int mcs51_flow(const struct mcs51_insn *insn)
+{
+    switch (insn->ops->format) {
+        case MCS51_INS_A11: case MCS51_INS_A16:
+        case MCS51_INS_A19: case MCS51_INS_A24:
+            /* acall/lcall differ from ajmp/ljmp by bit 4 */
+            if (insn->opcode & 0x10)
+                return MCS51_INSN_BRANCH | MCS51_INSN_CALL;
+            return MCS51_INSN_BRANCH | MCS51_INSN_STOP;
+
+        case MCS51_INS_OFF:
+            /* sjmp is the only unconditional relative jump */
+            if (insn->opcode == 0x80)
+                return MCS51_INSN_BRANCH | MCS51_INSN_STOP;
+            return MCS51_INSN_BRANCH | MCS51_INSN_COND;
+
+        case MCS51_INS_AIO: case MCS51_INS_ADO: case MCS51_INS_RIO:
+        case MCS51_INS_REO: case MCS51_INS_DIO: case MCS51_INS_BIO:
+        case MCS51_INS_TIO:
+            return MCS51_INSN_BRANCH | MCS51_INSN_COND;
+
+        case MCS51_INS_TAD:
+            return MCS51_INSN_INDIRECT | MCS51_INSN_STOP;
+
+        case MCS51_INS_NON:
+            /* ret and reti */
+            if (insn->opcode == 0x22 || insn->opcode == 0x32)
+                return MCS51_INSN_STOP;
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+/**
+ * mcs51_decode - decode one instruction into a record.
+ * @insn: record to fill.
+ * @data: instruction bytes.
+ * @len: number of valid bytes at @data, at least one.
+ * @addr: address of @data, used for branch targets.
+ *
+ * An instruction truncated by @len decodes as a single undecodable
+ * byte. Escaped instructions of the selected core are decoded from
+ * the byte after the escape. Returns the instruction length. No output
+ * is produced.
+ */
+unsigned int mcs51_decode(struct mcs51_insn *insn, const uint8_t *data,
+                          size_t len, uint32_t addr)
+{
+    const struct mcs51_ops *ops;
+
+    memset(insn, 0, sizeof(*insn));
+    insn->addr = addr;
+    insn->opcode = data[0];
+
+    ops = mcs51_dispatch[data[0]];
+    if (ops == NULL || ops->size > len) {
+        if (!(ops = mcs51_escaped(data, len))) {
+            insn->size = 1;
+            return 1;
+        }
+        insn->prefix = *data++;
+        insn->opcode = data[0];
+    }
+
+    insn->ops = ops;
+    insn->size = ops->size + !!insn->prefix;
+
+    switch (ops->format) {
+        case MCS51_INS_A11:
+            insn->addr16 = MCS51_A11(data, ops);
+            insn->target = ((addr + insn->size) & ~0x7ffUL) | insn->addr16;
+            break;
+
+        case MCS51_INS_A16:
+            insn->addr16 = MCS51_A16(data, ops);
+            insn->target = (addr & ~0xffffUL) | insn->addr16;
+            break;
+
+        case MCS51_INS_A19:
+            insn->addr24 = MCS51_A19(data, ops);
+            insn->addr16 = insn->addr24;
+            insn->target = ((addr + insn->size) & ~0x7ffffUL) | insn->addr24;
+            break;
+
+        case MCS51_INS_A24:
+            insn->addr24 = MCS51_A24(data, ops);
+            insn->addr16 = insn->addr24;
+            insn->target = insn->addr24;
+            break;
+
+        case MCS51_INS_PTL:
+            insn->addr24 = MCS51_A24(data, ops);
+            insn->addr16 = insn->addr24;
+            break;
+
+        case MCS51_INS_ACR: case MCS51_INS_ATR: case MCS51_INS_REG:
+        case MCS51_INS_REA: case MCS51_INS_TRE: case MCS51_INS_TRA:
+            insn->reg = MCS51_REG(data, ops);
+            break;
+
+        case MCS51_INS_ACI: case MCS51_INS_TPI:
+            insn->immed = data[1];
+            break;
+
+        case MCS51_INS_AIO:
+            insn->immed = data[1];
+            insn->rel = data[2];
+            break;
+
+        case MCS51_INS_ACD: case MCS51_INS_DIR: case MCS51_INS_DIA:
+            insn->direct = data[1];
+            break;
+
+        case MCS51_INS_ADO: case MCS51_INS_DIO:
+            insn->direct = data[1];
+            insn->rel = data[2];
+            break;
+
+        case MCS51_INS_REI: case MCS51_INS_TRI:
+            insn->reg = MCS51_REG(data, ops);
+            insn->immed = data[1];
+            break;
+
+        case MCS51_INS_RIO: case MCS51_INS_TIO:
+            insn->reg = MCS51_REG(data, ops);
+            insn->immed = data[1];
+            insn->rel = data[2];
+            break;
+
+        case MCS51_INS_RED: case MCS51_INS_DRE:
+        case MCS51_INS_DTR: case MCS51_INS_TRD:
+            insn->reg = MCS51_REG(data, ops);
+            insn->direct = data[1];
+            break;
+
+        case MCS51_INS_REO:
+            insn->reg = MCS51_REG(data, ops);
+            insn->rel = data[1];
+            break;
+
+        case MCS51_INS_DII:
+            insn->direct = data[1];
+            insn->immed = data[2];
+            break;
+
+        case MCS51_INS_DID:
+            insn->direct = data[1];
+            insn->direct2 = data[2];
+            break;
+
+        case MCS51_INS_PTI:
+            insn->addr16 = MCS51_A16(data, ops);
+            break;
+
+        case MCS51_INS_BIT: case MCS51_INS_BIC:
+        case MCS51_INS_COB: case MCS51_INS_COX:
+            insn->bit = data[1];
+            break;
+
+        case MCS51_INS_BIO:
+            insn->bit = data[1];
+            insn->rel = data[2];
+            break;
+
+        case MCS51_INS_OFF:
+            insn->rel = data[1];
+            break;
+
+        default:
+            break;
+    }
+
+    insn->flags = mcs51_flow(insn);
+    if ((insn->flags & MCS51_INSN_BRANCH) && ops->format != MCS51_INS_A11 &&
+        ops->format != MCS51_INS_A16 && ops->format != MCS51_INS_A19 &&
+        ops->format != MCS51_INS_A24)
+        insn->target = addr + insn->size + insn->rel;
+
+    return insn->size;
+}
+
+static const char mcs51_hex_digit[] = "0123456789abcdef";
+
+static const char mcs51_hex_pair[] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+static inline char *put_str(char *buf, const char *str)
+{
+    while (*str)
+        *buf++ = *str++;
+    return buf;
+}
+
+static inline char *put_pair(char *buf, uint8_t val)
+{
+    buf[0] = mcs51_hex_pair[val * 2];
+    buf[1] = mcs51_hex_pair[val * 2 + 1];
+    return buf + 2;
+}
+
+/* Same as "0x%02x" */
+static inline char *put_hex2(char *buf, uint8_t val)
+{
+    *buf++ = '0';
+    *buf++ = 'x';
+    return put_pair(buf, val);
+}
+
+/* Same as "0x%03x" for values below 0x1000 */
+static inline char *put_hex3(char *buf, uint16_t val)
+{
+    *buf++ = '0';
+    *buf++ = 'x';
+    *buf++ = mcs51_hex_digit[(val >> 8) & 0xf];
+    return put_pair(buf, val);
+}
+
+/* Same as "0x%04x" for values below 0x10000 */
+static inline char *put_hex4(char *buf, uint16_t val)
+{
+    *buf++ = '0';
+    *buf++ = 'x';
+    buf = put_pair(buf, val >> 8);
+    return put_pair(buf, val);
+}
+
+/* Same as "0x%0*x" with @digits digits, for values that fit */
+static inline char *put_hexn(char *buf, uint32_t val, unsigned int digits)
+{
+    *buf++ = '0';
+    *buf++ = 'x';
+    while (digits--)
+        *buf++ = mcs51_hex_digit[(val >> (digits * 4)) & 0xf];
+    return buf;
+}
+
+/* The data pointer, escaped instructions use the alternate one */
+static inline const char *mcs51_dptr(const struct mcs51_insn *insn)
+{
+    return insn->prefix ? "/dptr" : "dptr";
+}
+
+/**
+ * mcs51_decode_byte - fill a record that lists a byte as data.
+ * @insn: record to fill.
+ * @value: byte value.
+ * @addr: address of the byte.
+ */
+void mcs51_decode_byte(struct mcs51_insn *insn, uint8_t value, uint32_t addr)
+{
+    memset(insn, 0, sizeof(*insn));
+    insn->addr = addr;
+    insn->opcode = value;
+    insn->size = 1;
+}
+
+/**
+ * mcs51_format_addr - render an address as "0x%04lx".
+ * @buf: output buffer, at least 11 bytes.
+ * @addr: address to render.
+ *
+ * Returns the number of characters written, without terminator.
+ */
+int mcs51_format_addr(char *buf, uint32_t addr)
+{
+    unsigned int digits;
+    char *walk = buf;
+
+    if (addr <= 0xffff)
+        return put_hex4(buf, addr) - buf;
+
+    for (digits = 5; digits < 8 && (addr >> (digits * 4)); ++digits);
+
+    *walk++ = '0';
+    *walk++ = 'x';
+    while (digits--)
+        *walk++ = mcs51_hex_digit[(addr >> (digits * 4)) & 0xf];
+
+    return walk - buf;
+}
+
+/**
+ * mcs51_format_label - render a code label as "L_%04lx".
+ * @buf: output buffer, at least 11 bytes.
+ * @addr: address the label marks.
+ *
+ * Returns the number of characters written, without terminator.
+ */
+int mcs51_format_label(char *buf, uint32_t addr)
+{
+    int len;
+
+    len = mcs51_format_addr(buf, addr);
+    buf[0] = 'L';
+    buf[1] = '_';
+
+    return len;
+}
+
+/* Relative operand, as the raw offset or as the label of its target */
+static inline char *put_rel(char *buf, const struct mcs51_insn *insn)
+{
+    if (insn->flags & MCS51_INSN_SYMBOLIC)
+        return buf + mcs51_format_label(buf, insn->target);
+    return put_hex2(buf, insn->rel);
+}
+
+static inline char *put_direct(char *buf, const struct mcs51_symbols *sym, uint8_t addr)
+{
+    if (sym && sym->direct[addr][0])
+        return put_str(buf, sym->direct[addr]);
+    return put_hex2(buf, addr);
+}
+
+static inline char *put_bit(char *buf, const struct mcs51_symbols *sym, uint8_t addr)
+{
+    if (sym && sym->bit[addr][0])
+        return put_str(buf, sym->bit[addr]);
+    return put_hex2(buf, addr);
+}
+
+/**
+ * mcs51_format_insn - render a decoded instruction as text.
+ * @buf: output buffer, at least MCS51_LINE_MAX bytes.
+ * @insn: record filled by mcs51_decode.
+ * @sym: SFR and bit names to print, NULL for plain numbers.
+ *
+ * The only text formatter: print_insn_mcs51 prints its output and
+ * selftest.c checks it against the reference. Branch operands of
+ * records marked MCS51_INSN_SYMBOLIC name the label of their target,
+ * and direct and bit operands with an entry in @sym print that name.
+ * Returns the number of characters written, without terminator.
+ */
+int mcs51_format_insn(char *buf, const struct mcs51_insn *insn,
+                      const struct mcs51_symbols *sym)
+{
+    const struct mcs51_ops *ops = insn->ops;
+    char *walk = buf;
+
     if (ops == NULL) {
-        printf("\tbyte\t\t0x%02x", data[0]);
-        return 1;
+        walk = put_str(walk, "\tbyte\t\t");
+        walk = put_hex2(walk, insn->opcode);
+        *walk = '\0';
+        return walk - buf;
     }
 
-    printf("\t%s", ops->name);
+    *walk++ = '\t';
+    walk = put_str(walk, ops->name);
+    if (ops->format != MCS51_INS_NON) {
+        *walk++ = '\t';
+        *walk++ = '\t';
+    }
 
     switch (ops->format) {
         case MCS51_INS_NON:
             break;
 
         case MCS51_INS_A11:
-            printf("\t\t0x%03x", MCS51_A11(data, ops));
+            if (insn->flags & MCS51_INSN_SYMBOLIC)
+                walk += mcs51_format_label(walk, insn->target);
+            else
+                walk = put_hex3(walk, insn->addr16);
             break;
 
         case MCS51_INS_A16:
-            printf("\t\t0x%04x", MCS51_A16(data, ops));
+            if (insn->flags & MCS51_INSN_SYMBOLIC)
+                walk += mcs51_format_label(walk, insn->target);
+            else
+                walk = put_hex4(walk, insn->addr16);
+            break;
+
+        case MCS51_INS_A19:
+            if (insn->flags & MCS51_INSN_SYMBOLIC)
+                walk += mcs51_format_label(walk, insn->target);
+            else
+                walk = put_hexn(walk, insn->addr24, 5);
+            break;
+
+        case MCS51_INS_A24:
+            if (insn->flags & MCS51_INSN_SYMBOLIC)
+                walk += mcs51_format_label(walk, insn->target);
+            else
+                walk = put_hexn(walk, insn->addr24, 6);
             break;
 
         case MCS51_INS_ACC:
-            printf("\t\ta");
+            *walk++ = 'a';
             break;
 
         case MCS51_INS_ACB:
-            printf("\t\tab");
+            walk = put_str(walk, "ab");
             break;
 
         case MCS51_INS_ACR:
-            printf("\t\ta, %s", mcs51_reg_name[MCS51_REG(data, ops)]);
+            walk = put_str(walk, "a, ");
+            walk = put_str(walk, mcs51_reg_name[insn->reg]);
             break;
 
         case MCS51_INS_ATR:
-            printf("\t\ta, @%s", mcs51_treg_name[MCS51_REG(data, ops)]);
+            walk = put_str(walk, "a, @");
+            walk = put_str(walk, mcs51_treg_name[insn->reg]);
             break;
 
         case MCS51_INS_ACI:
-            printf("\t\ta, #0x%02x", data[1]);
+            walk = put_str(walk, "a, #");
+            walk = put_hex2(walk, insn->immed);
             break;
 
         case MCS51_INS_AIO:
-            printf("\t\ta, #0x%02x, 0x%02x", data[1], data[2]);
+            walk = put_str(walk, "a, #");
+            walk = put_hex2(walk, insn->immed);
+            walk = put_str(walk, ", ");
+            walk = put_rel(walk, insn);
             break;
 
         case MCS51_INS_ACD:
-            printf("\t\ta, 0x%02x", data[1]);
+            walk = put_str(walk, "a, ");
+            walk = put_direct(walk, sym, insn->direct);
             break;
 
         case MCS51_INS_ADO:
-            printf("\t\ta, 0x%02x, 0x%02x", data[1], data[2]);
+            walk = put_str(walk, "a, ");
+            walk = put_direct(walk, sym, insn->direct);
+            walk = put_str(walk, ", ");
+            walk = put_rel(walk, insn);
             break;
 
         case MCS51_INS_ATP:
-            printf("\t\ta, @dptr");
+            walk = put_str(walk, "a, @");
+            walk = put_str(walk, mcs51_dptr(insn));
             break;
 
         case MCS51_INS_ATA:
-            printf("\t\ta, @a+dptr");
+            walk = put_str(walk, "a, @a+");
+            walk = put_str(walk, mcs51_dptr(insn));
             break;
 
         case MCS51_INS_ATC:
-            printf("\t\ta, @a+pc");
+            walk = put_str(walk, "a, @a+pc");
             break;
 
         case MCS51_INS_REG:
-            printf("\t\t%s", mcs51_reg_name[MCS51_REG(data, ops)]);
+            walk = put_str(walk, mcs51_reg_name[insn->reg]);
             break;
 
         case MCS51_INS_REA:
-            printf("\t\t%s, a", mcs51_reg_name[MCS51_REG(data, ops)]);
+            walk = put_str(walk, mcs51_reg_name[insn->reg]);
+            walk = put_str(walk, ", a");
             break;
 
         case MCS51_INS_REI:
-            printf("\t\t%s, #0x%02x", mcs51_reg_name[MCS51_REG(data, ops)], data[1]);
+            walk = put_str(walk, mcs51_reg_name[insn->reg]);
+            walk = put_str(walk, ", #");
+            walk = put_hex2(walk, insn->immed);
             break;
 
         case MCS51_INS_RIO:
-            printf("\t\t%s, #0x%02x, 0x%02x", mcs51_reg_name[MCS51_REG(data, ops)], data[1], data[2]);
+            walk = put_str(walk, mcs51_reg_name[insn->reg]);
+            walk = put_str(walk, ", #");
+            walk = put_hex2(walk, insn->immed);
+            walk = put_str(walk, ", ");
+            walk = put_rel(walk, insn);
             break;
 
         case MCS51_INS_RED:
-            printf("\t\t%s, 0x%02x", mcs51_reg_name[MCS51_REG(data, ops)], data[1]);
+            walk = put_str(walk, mcs51_reg_name[insn->reg]);
+            walk = put_str(walk, ", ");
+            walk = put_direct(walk, sym, insn->direct);
             break;
 
         case MCS51_INS_REO:
-            printf("\t\t%s, 0x%02x", mcs51_reg_name[MCS51_REG(data, ops)], data[1]);
+            walk = put_str(walk, mcs51_reg_name[insn->reg]);
+            walk = put_str(walk, ", ");
+            walk = put_rel(walk, insn);
             break;
 
         case MCS51_INS_DIR:
-            printf("\t\t0x%02x", data[1]);
+            walk = put_direct(walk, sym, insn->direct);
             break;
 
         case MCS51_INS_DIA:
-            printf("\t\t0x%02x, a", data[1]);
+            walk = put_direct(walk, sym, insn->direct);
+            walk = put_str(walk, ", a");
             break;
 
         case MCS51_INS_DRE:
-            printf("\t\t0x%02x, %s", data[1], mcs51_reg_name[MCS51_REG(data, ops)]);
+            walk = put_direct(walk, sym, insn->direct);
+            walk = put_str(walk, ", ");
+            walk = put_str(walk, mcs51_reg_name[insn->reg]);
             break;
 
         case MCS51_INS_DTR:
-            printf("\t\t0x%02x, %s", data[1], mcs51_treg_name[MCS51_REG(data, ops)]);
+            walk = put_direct(walk, sym, insn->direct);
+            walk = put_str(walk, ", ");
+            walk = put_str(walk, mcs51_treg_name[insn->reg]);
             break;
 
         case MCS51_INS_DII:
-            printf("\t\t0x%02x, #0x%02x", data[1], data[2]);
+            walk = put_direct(walk, sym, insn->direct);
+            walk = put_str(walk, ", #");
+            walk = put_hex2(walk, insn->immed);
             break;
 
         case MCS51_INS_DID:
-            printf("\t\t0x%02x, 0x%02x", data[1], data[2]);
+            walk = put_direct(walk, sym, insn->direct);
+            walk = put_str(walk, ", ");
+            walk = put_direct(walk, sym, insn->direct2);
             break;
 
         case MCS51_INS_DIO:
-            printf("\t\t0x%02x, 0x%02x", data[1], data[2]);
+            walk = put_direct(walk, sym, insn->direct);
+            walk = put_str(walk, ", ");
+            walk = put_rel(walk, insn);
             break;
 
         case MCS51_INS_PTR:
-            printf("\t\tdptr");
+            walk = put_str(walk, mcs51_dptr(insn));
             break;
 
         case MCS51_INS_PTI:
-            printf("\t\tdptr, 0x%02x", data[1]);
+            walk = put_str(walk, mcs51_dptr(insn));
+            walk = put_str(walk, ", ");
+            walk = put_hex2(walk, insn->addr16 >> 8);
+            break;
+
+        case MCS51_INS_PTL:
+            walk = put_str(walk, "dptr, #");
+            walk = put_hexn(walk, insn->addr24, 6);
             break;
 
         case MCS51_INS_BIT:
-            printf("\t\t0x%02x", data[1]);
+            walk = put_bit(walk, sym, insn->bit);
             break;
 
         case MCS51_INS_BIC:
-            printf("\t\t0x%02x, c", data[1]);
+            walk = put_bit(walk, sym, insn->bit);
+            walk = put_str(walk, ", c");
             break;
 
         case MCS51_INS_BIO:
-            printf("\t\t0x%02x, 0x%02x", data[1], data[2]);
+            walk = put_bit(walk, sym, insn->bit);
+            walk = put_str(walk, ", ");
+            walk = put_rel(walk, insn);
             break;
 
         case MCS51_INS_CON:
-            printf("\t\tc");
+            *walk++ = 'c';
             break;
 
         case MCS51_INS_COB:
-            printf("\t\tc, 0x%02x", data[1]);
+            walk = put_str(walk, "c, ");
+            walk = put_bit(walk, sym, insn->bit);
             break;
 
         case MCS51_INS_COX:
-            printf("\t\tc, /0x%02x", data[1]);
+            walk = put_str(walk, "c, /");
+            walk = put_bit(walk, sym, insn->bit);
             break;
 
         case MCS51_INS_TRE:
-            printf("\t\t%s", mcs51_treg_name[MCS51_REG(data, ops)]);
+            walk = put_str(walk, mcs51_treg_name[insn->reg]);
             break;
 
         case MCS51_INS_TRA:
-            printf("\t\t%s, a", mcs51_treg_name[MCS51_REG(data, ops)]);
+            walk = put_str(walk, mcs51_treg_name[insn->reg]);
+            walk = put_str(walk, ", a");
             break;
 
         case MCS51_INS_TRI:
-            printf("\t\t%s, #0x%02x", mcs51_treg_name[MCS51_REG(data, ops)], data[1]);
+            walk = put_str(walk, mcs51_treg_name[insn->reg]);
+            walk = put_str(walk, ", #");
+            walk = put_hex2(walk, insn->immed);
             break;
 
         case MCS51_INS_TIO:
-            printf("\t\t%s, #0x%02x, 0x%02x", mcs51_treg_name[MCS51_REG(data, ops)], data[1], data[2]);
+            walk = put_str(walk, mcs51_treg_name[insn->reg]);
+            walk = put_str(walk, ", #");
+            walk = put_hex2(walk, insn->immed);
+            walk = put_str(walk, ", ");
+            walk = put_rel(walk, insn);
             break;
 
         case MCS51_INS_TRD:
-            printf("\t\t%s, 0x%02x", mcs51_treg_name[MCS51_REG(data, ops)], data[1]);
+            walk = put_str(walk, mcs51_treg_name[insn->reg]);
+            walk = put_str(walk, ", ");
+            walk = put_direct(walk, sym, insn->direct);
             break;
 
         case MCS51_INS_TPA:
-            printf("\t\t@dptr, a");
+            *walk++ = '@';
+            walk = put_str(walk, mcs51_dptr(insn));
+            walk = put_str(walk, ", a");
             break;
 
         case MCS51_INS_TAD:
-            printf("\t\t@a+dptr");
+            walk = put_str(walk, "@a+");
+            walk = put_str(walk, mcs51_dptr(insn));
             break;
 
         case MCS51_INS_TPI:
-            printf("\t\t@dptr, #0x%02x", data[1]);
+            walk = put_str(walk, "@dptr, #");
+            walk = put_hex2(walk, insn->immed);
             break;
 
         case MCS51_INS_OFF:
-            printf("\t\t0x%02x", data[1]);
+            walk = put_rel(walk, insn);
             break;
 
         default:
-            printf("\t\tundecoded operands, inst is 0x%04x", data[0]);
+            walk = put_str(walk, "undecoded operands, inst is ");
+            walk = put_hex4(walk, insn->opcode);
             break;
     }
 
-    return ops->size;
+    *walk = '\0';
+    return walk - buf;
+}
+
+/**
+ * print_insn_mcs51 - decode and print one instruction through stdio.
+ * @data: instruction bytes.
+ * @len: number of valid bytes at @data, at least one.
+ *
+ * The original stdio entry point, now a thin wrapper around
+ * mcs51_decode and mcs51_format_insn. Returns the instruction size.
+ */
+int print_insn_mcs51(const uint8_t *data, size_t len)
+{
+    char line[MCS51_LINE_MAX];
+    struct mcs51_insn insn;
+
+    mcs51_decode(&insn, data, len, 0);
+    mcs51_format_insn(line, &insn, NULL);
+    fputs(line, stdout);
+
+    return insn.size;
 }
@@ -9,6 +9,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "mcs51-ops.h"
 
 /**
  * ARRAY_SIZE - get the number of elements in array.
@@ -18,6 +21,541 @@
     sizeof(arr) / sizeof((arr)[0]) \
 )
 
-extern int print_insn_mcs51(uint8_t *data);
+enum mcs51_insn_flags {
+    MCS51_INSN_BRANCH   = 1 << 0,   /* target is valid              */
+    MCS51_INSN_CALL     = 1 << 1,   /* returns to the next insn     */
+    MCS51_INSN_COND     = 1 << 2,   /* may fall through             */
+    MCS51_INSN_STOP     = 1 << 3,   /* never falls through          */
+    MCS51_INSN_INDIRECT = 1 << 4,   /* target computed at runtime   */
+    MCS51_INSN_LABEL    = 1 << 5,   /* branched to, gets a label    */
+    MCS51_INSN_SYMBOLIC = 1 << 6,   /* target printed as its label  */
+    MCS51_INSN_DATA     = 1 << 7,   /* byte read as a table         */
+};
+
+/**
+ * struct mcs51_insn - decoded instruction record.
+ * @ops: matching opcode table entry, NULL for an undecodable byte.
+ * @addr: address of the first instruction byte.
+ * @target: branch target, valid with MCS51_INSN_BRANCH.
+ * @addr24: addr19/addr24 operand or 24-bit immediate.
+ * @addr16: addr11/addr16 operand or 16-bit immediate, the low
+ *          16 bits of @addr24 where that is used.
+ * @prefix: escape byte in front of @opcode, zero for none.
+ * @opcode: first instruction byte after any escape.
+ * @size: instruction length in bytes, escape included.
+ * @reg: register index of the reg and @reg forms.
+ * @direct: first direct address operand.
+ * @direct2: second direct address operand.
+ * @immed: immediate operand.
+ * @bit: bit address operand.
+ * @rel: relative branch offset.
+ * @flags: mcs51_insn_flags of the instruction.
+ */
+struct mcs51_insn {
+    const struct mcs51_ops *ops;
+    uint32_t addr;
+    uint32_t target;
+    uint32_t addr24;
+    uint16_t addr16;
+    uint8_t prefix;
+    uint8_t opcode;
+    uint8_t size;
+    uint8_t reg;
+    uint8_t direct;
+    uint8_t direct2;
+    uint8_t immed;
+    uint8_t bit;
+    int8_t rel;
+    uint8_t flags;
+};
+
+#define MCS51_BITMAP_LONGS(bits) ( \
+    ((bits) + sizeof(long) * 8 - 1) / (sizeof(long) * 8) \
+)
+
+static inline bool mcs51_bit_test(const unsigned long *map, size_t bit)
+{
+    return (map[bit / (sizeof(long) * 8)] >> (bit % (sizeof(long) * 8))) & 1;
+}
+
+static inline void mcs51_bit_set(unsigned long *map, size_t bit)
+{
+    map[bit / (sizeof(long) * 8)] |= 1UL << (bit % (sizeof(long) * 8));
+}
+
+static inline void mcs51_bit_clear(unsigned long *map, size_t bit)
+{
+    map[bit / (sizeof(long) * 8)] &= ~(1UL << (bit % (sizeof(long) * 8)));
+}
+
+/* Longest instruction of any variant in bytes */
+#define MCS51_INSN_MAX  4
+
+/* Longest line produced by mcs51_format_insn, terminator included */
+#define MCS51_LINE_MAX  64
+
+/* Longest JSON line, a three operand instruction with long symbol names */
+#define MCS51_JSON_MAX  512
+
+/* Longest SFR or bit name, terminator included */
+#define MCS51_SYMBOL_LEN 16
+
+/**
+ * struct mcs51_symbols - SFR and bit address names of a dialect.
+ * @direct: name of each direct address, empty when unnamed.
+ * @bit: name of each bit address, empty when unnamed.
+ * @generated: set for @bit names derived from their register name.
+ */
+struct mcs51_symbols {
+    char direct[256][MCS51_SYMBOL_LEN];
+    char bit[256][MCS51_SYMBOL_LEN];
+    unsigned long generated[MCS51_BITMAP_LONGS(256)];
+};
+
+enum mcs51_output {
+    MCS51_OUTPUT_TEXT,      /* assembler listing            */
+    MCS51_OUTPUT_JSON,      /* one JSON object per line     */
+    MCS51_OUTPUT_BIN,       /* struct mcs51_record stream   */
+};
+
+#define MCS51_RECORD_MAGIC      "MCS51REC"
+/* Version 2 added prefix and addr_high, and numbers escape and overlay entries */
+#define MCS51_RECORD_VERSION    2
+
+/**
+ * struct mcs51_record_head - start of a binary record stream.
+ * @magic: MCS51_RECORD_MAGIC, not terminated.
+ * @version: MCS51_RECORD_VERSION.
+ * @size: size of each record that follows.
+ *
+ * Every field of the stream is little-endian.
+ */
+struct mcs51_record_head {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+};
+
+/**
+ * struct mcs51_record - fixed-width binary form of struct mcs51_insn.
+ * @addr: address of the first instruction byte.
+ * @target: branch target, valid with MCS51_INSN_BRANCH.
+ * @addr16: addr11/addr16 operand or 16-bit immediate.
+ * @opcode: first instruction byte after any escape.
+ * @size: instruction length in bytes.
+ * @index: entry as numbered by mcs51_ops_index, 0xff for an undecodable byte.
+ * @format: enum mcs51_format, 0xff for an undecodable byte.
+ * @reg: register index of the reg and @reg forms.
+ * @flags: mcs51_insn_flags of the instruction.
+ * @direct: first direct address operand.
+ * @direct2: second direct address operand.
+ * @immed: immediate operand.
+ * @bit: bit address operand.
+ * @rel: relative branch offset.
+ * @prefix: escape byte in front of @opcode, zero for none.
+ * @addr_high: bits 16 to 23 of an addr19/addr24 operand or 24-bit immediate.
+ * @reserved: zero.
+ */
+struct mcs51_record {
+    uint32_t addr;
+    uint32_t target;
+    uint16_t addr16;
+    uint8_t opcode;
+    uint8_t size;
+    uint8_t index;
+    uint8_t format;
+    uint8_t reg;
+    uint8_t flags;
+    uint8_t direct;
+    uint8_t direct2;
+    uint8_t immed;
+    uint8_t bit;
+    int8_t rel;
+    uint8_t prefix;
+    uint8_t addr_high;
+    uint8_t reserved[1];
+};
+
+/**
+ * struct mcs51_emit - buffered output.
+ * @fd: file descriptor the buffer is flushed to, or -1 to keep the
+ *      whole output in memory.
+ * @len: number of pending bytes.
+ * @size: capacity of @buf.
+ * @buf: pending output.
+ * @sym: names for direct and bit operands, NULL for numbers only.
+ * @output: format of the output, text unless set after init.
+ */
+struct mcs51_emit {
+    int fd;
+    size_t len;
+    size_t size;
+    char *buf;
+    const struct mcs51_symbols *sym;
+    enum mcs51_output output;
+};
+
+#define MCS51_EMIT_SIZE (1UL << 20)
+
+/**
+ * struct mcs51_segment - contiguous run of image bytes.
+ * @addr: load address of the first byte.
+ * @size: number of bytes.
+ * @data: segment contents.
+ */
+struct mcs51_segment {
+    uint32_t addr;
+    size_t size;
+    const uint8_t *data;
+};
+
+/**
+ * struct mcs51_image - sparse image parsed from a text format.
+ * @segs: segments sorted by load address.
+ * @nr_segs: number of valid @segs.
+ * @max_segs: allocated size of @segs.
+ * @buf: storage backing every segment.
+ * @used: bytes of @buf in use.
+ * @line: line being parsed, reported on errors.
+ */
+struct mcs51_image {
+    struct mcs51_segment *segs;
+    size_t nr_segs;
+    size_t max_segs;
+    uint8_t *buf;
+    size_t used;
+    unsigned long line;
+};
+
+/**
+ * struct mcs51_listing - decoded records of a whole image.
+ * @insns: records in address order.
+ * @nr_insns: number of valid @insns.
+ * @max_insns: allocated size of @insns.
+ */
+struct mcs51_listing {
+    struct mcs51_insn *insns;
+    size_t nr_insns;
+    size_t max_insns;
+};
+
+/* Locations tracked by the emulator, R0-R7 of the current bank first */
+#define MCS51_EMU_A     8
+#define MCS51_EMU_B     9
+#define MCS51_EMU_LOCS  10
+#define MCS51_EMU_NONE  0xff
+
+enum mcs51_emu_carry {
+    MCS51_CARRY_CLEAR,      /* known clear                  */
+    MCS51_CARRY_SET,        /* known set                    */
+    MCS51_CARRY_ANY,        /* unknown                      */
+    MCS51_CARRY_LT,         /* set iff cloc below cval      */
+    MCS51_CARRY_GE,         /* set iff cloc at least cval   */
+};
+
+/**
+ * struct mcs51_emu - abstract machine state along one path.
+ * @lo: lowest value each location may hold.
+ * @hi: highest value each location may hold.
+ * @dptr: value of dptr, valid with @dptr_known.
+ * @dptr_known: @dptr holds a constant.
+ * @dptr_wide: @dptr was loaded by the 24-bit mov dptr of the core.
+ * @alias: register that holds the same value as A, MCS51_EMU_NONE for none.
+ * @carry: mcs51_emu_carry state of the carry flag.
+ * @cloc: location the carry relation is about.
+ * @cval: bound of the carry relation.
+ *
+ * Every location is an interval, a constant has @lo equal to @hi. The
+ * state is flat and copied by value, nothing is ever allocated.
+ */
+struct mcs51_emu {
+    uint8_t lo[MCS51_EMU_LOCS];
+    uint8_t hi[MCS51_EMU_LOCS];
+    uint32_t dptr;
+    bool dptr_known;
+    bool dptr_wide;
+    uint8_t alias;
+    uint8_t carry;
+    uint8_t cloc;
+    uint8_t cval;
+};
+
+/**
+ * struct mcs51_trace_work - address waiting to be followed.
+ * @addr: address to decode from.
+ * @emu: machine state on arrival.
+ */
+struct mcs51_trace_work {
+    uint32_t addr;
+    struct mcs51_emu emu;
+};
+
+/**
+ * struct mcs51_trace_state - machine state joined over every arriving path.
+ * @emu: hull of the states seen at an instruction.
+ * @joins: number of times @emu has widened.
+ */
+struct mcs51_trace_state {
+    struct mcs51_emu emu;
+    unsigned int joins;
+};
+
+/**
+ * struct mcs51_trace - recursive traversal state.
+ * @segs: image segments sorted by address.
+ * @nr_segs: number of @segs.
+ * @last: segment of the previous lookup.
+ * @base: bit index of the first byte of each segment.
+ * @bits: number of image bytes.
+ * @code: set for every byte that starts a reached instruction.
+ * @data: set for every byte read by movc from a resolved table.
+ * @slot: per byte, one past the index of its state in @states, 0 for none.
+ * @states: joined state of every reached instruction.
+ * @nr_states: number of used @states.
+ * @max_states: allocated size of @states.
+ * @work: addresses waiting to be followed.
+ * @nr_work: number of pending @work entries.
+ * @max_work: allocated size of @work.
+ */
+struct mcs51_trace {
+    const struct mcs51_segment *segs;
+    size_t nr_segs;
+    size_t last;
+    size_t *base;
+    size_t bits;
+    unsigned long *code;
+    unsigned long *data;
+    uint32_t *slot;
+    struct mcs51_trace_state *states;
+    size_t nr_states;
+    size_t max_states;
+    struct mcs51_trace_work *work;
+    size_t nr_work;
+    size_t max_work;
+};
+
+enum mcs51_xref_kind {
+    MCS51_XREF_CALL,        /* acall, lcall target          */
+    MCS51_XREF_JUMP,        /* jump and branch target       */
+    MCS51_XREF_DIRECT,      /* direct address operand       */
+    MCS51_XREF_BIT,         /* bit address operand          */
+    MCS51_XREF_DPTR,        /* mov dptr,#immed constant     */
+    MCS51_XREF_KINDS,
+};
+
+#define MCS51_XREF_MAGIC        "MCS51XRF"
+#define MCS51_XREF_VERSION      1
+
+/**
+ * struct mcs51_xref_entry - one reference.
+ * @to: referenced address.
+ * @from: address of the referencing instruction.
+ *
+ * Both fields are little-endian, in memory as well as in the index file.
+ */
+struct mcs51_xref_entry {
+    uint32_t to;
+    uint32_t from;
+};
+
+/**
+ * struct mcs51_xref_head - start of a cross-reference index file.
+ * @magic: MCS51_XREF_MAGIC, not terminated.
+ * @version: MCS51_XREF_VERSION.
+ * @kinds: MCS51_XREF_KINDS.
+ * @first: entry index each kind starts at, the last one is the total.
+ *
+ * The entries follow, every field is little-endian.
+ */
+struct mcs51_xref_head {
+    char magic[8];
+    uint32_t version;
+    uint32_t kinds;
+    uint64_t first[MCS51_XREF_KINDS + 1];
+};
+
+/**
+ * struct mcs51_xref - cross-reference tables of an image.
+ * @refs: entries of every kind, sorted by target then source.
+ * @first: index of the first entry of each kind, the last one is the total.
+ * @owned: @refs was allocated by mcs51_xref_build.
+ */
+struct mcs51_xref {
+    struct mcs51_xref_entry *refs;
+    size_t first[MCS51_XREF_KINDS + 1];
+    bool owned;
+};
+
+enum mcs51_phase {
+    MCS51_PHASE_LOAD,       /* reading and parsing input    */
+    MCS51_PHASE_DECODE,     /* mcs51_decode                 */
+    MCS51_PHASE_FORMAT,     /* rendering the listing        */
+    MCS51_PHASE_WRITE,      /* writing the output           */
+    MCS51_PHASES,
+};
+
+/**
+ * struct mcs51_stats - profile of an instrumented run.
+ * @phase: seconds spent in each mcs51_phase.
+ * @opcodes: instructions by first byte.
+ * @formats: instructions by enum mcs51_format, undecodable bytes last.
+ * @insns: number of instructions.
+ * @bytes: number of image bytes they cover.
+ */
+struct mcs51_stats {
+    double phase[MCS51_PHASES];
+    unsigned long opcodes[256];
+    unsigned long formats[MCS51_INS_PTL + 2];
+    unsigned long insns;
+    unsigned long bytes;
+};
+
+struct mcs51_cache_slot;
+
+/**
+ * struct mcs51_cache - on-disk cache of rendered listing blocks.
+ * @index_fd: descriptor of the index file, also the writer lock.
+ * @blob_fd: descriptor of the rendered block file.
+ * @index: mapping of the index file.
+ * @slots: slot table inside @index.
+ * @fingerprint: digest of the current decoder output.
+ * @seed: @fingerprint mixed with the symbols in use.
+ * @hits: blocks served from the cache.
+ * @misses: blocks rendered and stored.
+ * @lock: serializes writers sharing this descriptor.
+ */
+struct mcs51_cache {
+    int index_fd;
+    int blob_fd;
+    void *index;
+    struct mcs51_cache_slot *slots;
+    uint64_t fingerprint;
+    uint64_t seed;
+    unsigned long hits;
+    unsigned long misses;
+    pthread_mutex_t lock;
+};
+
+extern const char *const mcs51_reg_name[8];
+extern const char *const mcs51_treg_name[2];
+extern const struct mcs51_ops mcs51_table[];
+extern const struct mcs51_ops mcs51_ext_table[];
+extern const struct mcs51_variant mcs51_variant_table[];
+extern const unsigned int mcs51_nr_table;
+extern const unsigned int mcs51_nr_ext_table;
+extern const unsigned int mcs51_nr_variants;
+
+extern unsigned int mcs51_insn_size(const uint8_t *data, size_t len);
+extern unsigned int mcs51_decode(struct mcs51_insn *insn, const uint8_t *data,
+                                 size_t len, uint32_t addr);
+extern unsigned int mcs51_ops_index(const struct mcs51_ops *ops);
+extern int mcs51_variant_select(const char *name);
+extern const char *mcs51_variant_name(void);
+extern void mcs51_decode_byte(struct mcs51_insn *insn, uint8_t value, uint32_t addr);
+extern int mcs51_format_addr(char *buf, uint32_t addr);
+extern int mcs51_format_label(char *buf, uint32_t addr);
+extern int mcs51_format_insn(char *buf, const struct mcs51_insn *insn,
+                             const struct mcs51_symbols *sym);
+
+extern void mcs51_emit_init(struct mcs51_emit *emit, int fd, size_t size);
+extern void mcs51_emit_exit(struct mcs51_emit *emit);
+extern void mcs51_emit_flush(struct mcs51_emit *emit);
+extern void mcs51_emit_room(struct mcs51_emit *emit, size_t size);
+extern void mcs51_emit_insn(struct mcs51_emit *emit, const struct mcs51_insn *insn);
+extern void mcs51_emit_begin(struct mcs51_emit *emit);
+extern void mcs51_emit_file(struct mcs51_emit *emit, const char *name);
+extern void mcs51_emit_json(struct mcs51_emit *emit, const struct mcs51_insn *insn);
+extern void mcs51_emit_record(struct mcs51_emit *emit, const struct mcs51_insn *insn);
+extern size_t mcs51_emit_range(struct mcs51_emit *emit, const uint8_t *data,
+                               size_t size, size_t start, size_t end, uint32_t base);
+extern void mcs51_emit_stream(struct mcs51_emit *emit, int fd);
+extern void mcs51_disasm_parallel(int fd, const uint8_t *data, size_t size,
+                                  uint32_t base, unsigned int threads,
+                                  const struct mcs51_symbols *sym,
+                                  enum mcs51_output output);
+
+extern int mcs51_load_ihex(struct mcs51_image *image, const char *text, size_t size);
+extern int mcs51_load_srec(struct mcs51_image *image, const char *text, size_t size);
+extern void mcs51_image_release(struct mcs51_image *image);
+
+extern int mcs51_symbols_builtin(struct mcs51_symbols *sym, const char *dialect);
+extern int mcs51_symbols_load(struct mcs51_symbols *sym, const char *text, size_t size,
+                              unsigned long *line);
+
+extern void mcs51_emu_reset(struct mcs51_emu *emu);
+extern bool mcs51_emu_join(struct mcs51_emu *emu, const struct mcs51_emu *other, bool widen);
+extern void mcs51_emu_step(struct mcs51_emu *emu, struct mcs51_emu *taken,
+                           const struct mcs51_insn *insn);
+extern bool mcs51_emu_table(const struct mcs51_emu *emu, const struct mcs51_insn *insn,
+                            uint32_t *base, unsigned int *lo, unsigned int *hi);
+extern void mcs51_emu_load(struct mcs51_emu *emu, unsigned int lo, unsigned int hi);
+
+extern void mcs51_trace_init(struct mcs51_trace *trace, const struct mcs51_segment *segs,
+                             size_t nr_segs);
+extern void mcs51_trace_release(struct mcs51_trace *trace);
+extern long mcs51_trace_locate(struct mcs51_trace *trace, uint32_t addr, size_t *avail);
+extern void mcs51_trace_entry(struct mcs51_trace *trace, uint32_t addr);
+extern void mcs51_trace_run(struct mcs51_trace *trace);
+extern void mcs51_trace_byte(const struct mcs51_trace *trace, struct mcs51_insn *insn,
+                             size_t index, size_t offset);
+extern void mcs51_trace_emit(struct mcs51_trace *trace, struct mcs51_emit *emit);
+
+extern int mcs51_cache_open(struct mcs51_cache *cache, const char *path,
+                            const struct mcs51_symbols *sym);
+extern void mcs51_cache_close(struct mcs51_cache *cache);
+extern void mcs51_emit_cached(struct mcs51_cache *cache, struct mcs51_emit *emit,
+                              const uint8_t *data, size_t size, uint32_t base);
+
+extern unsigned long mcs51_emit_diff(struct mcs51_emit *emit,
+                                     const struct mcs51_segment *old,
+                                     const struct mcs51_segment *new,
+                                     const char *old_name, const char *new_name);
+
+extern void mcs51_xref_build(struct mcs51_xref *xref, const struct mcs51_segment *segs,
+                             size_t nr_segs, const struct mcs51_trace *trace);
+extern int mcs51_xref_load(struct mcs51_xref *xref, const void *data, size_t size);
+extern void mcs51_xref_save(const struct mcs51_xref *xref, struct mcs51_emit *emit);
+extern void mcs51_xref_release(struct mcs51_xref *xref);
+extern const struct mcs51_xref_entry *mcs51_xref_find(const struct mcs51_xref *xref,
+                                                      enum mcs51_xref_kind kind,
+                                                      uint32_t to, size_t *count);
+extern enum mcs51_xref_kind mcs51_xref_kind(const char *name);
+extern void mcs51_xref_callgraph(const struct mcs51_xref *xref, struct mcs51_emit *emit,
+                                 bool json);
+
+extern double mcs51_stats_clock(void);
+extern void mcs51_stats_flush(struct mcs51_stats *stats, struct mcs51_emit *emit);
+extern size_t mcs51_stats_range(struct mcs51_stats *stats, struct mcs51_emit *emit,
+                                const uint8_t *data, size_t size, size_t start,
+                                size_t end, uint32_t base);
+extern void mcs51_stats_report(const struct mcs51_stats *stats);
+
+extern void mcs51_listing_init(struct mcs51_listing *listing);
+extern void mcs51_listing_release(struct mcs51_listing *listing);
+extern struct mcs51_insn *mcs51_listing_find(const struct mcs51_listing *listing, uint32_t addr);
+extern void mcs51_listing_linear(struct mcs51_listing *listing,
+                                 const struct mcs51_segment *segs, size_t nr_segs);
+extern void mcs51_listing_trace(struct mcs51_listing *listing, struct mcs51_trace *trace);
+extern void mcs51_listing_label(struct mcs51_listing *listing);
+extern void mcs51_listing_emit(const struct mcs51_listing *listing, struct mcs51_emit *emit);
+
+/**
+ * mcs51_emit_reserve - make room for @size bytes of output.
+ * @emit: emitter to reserve on.
+ * @size: number of bytes the caller is going to write.
+ *
+ * Returns where to write. The caller advances @emit->len afterwards.
+ */
+static inline char *mcs51_emit_reserve(struct mcs51_emit *emit, size_t size)
+{
+    if (emit->size - emit->len < size)
+        mcs51_emit_room(emit, size);
+    return emit->buf + emit->len;
+}
+
+extern int print_insn_mcs51(const uint8_t *data, size_t len);
+extern int mcs51_dispatch_check(void);
+extern unsigned int mcs51_selftest(void);
+extern int mcs51_fuzz_one(const uint8_t *data, size_t size);
 
 #endif  /* _MCS51_DISASM_H_ */
@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#ifndef _MCS51_OPS_H_
+#define _MCS51_OPS_H_
+
+#include <stdint.h>
+
+enum mcs51_format { /* MCS-51 format table              */
+    MCS51_INS_NON,      /* ins                          */
+    MCS51_INS_A11,      /* ins  addr11                  */
+    MCS51_INS_A16,      /* ins  addr16                  */
+
+    MCS51_INS_ACC,      /* ins  a                       */
+    MCS51_INS_ACB,      /* ins  ab                      */
+    MCS51_INS_ACR,      /* ins  a, reg                  */
+    MCS51_INS_ATR,      /* ins  a, @reg                 */
+    MCS51_INS_ACI,      /* ins  a, #immed               */
+    MCS51_INS_AIO,      /* ins  a, #immed, offset       */
+    MCS51_INS_ACD,      /* ins  a, direct               */
+    MCS51_INS_ADO,      /* ins  a, direct, offset       */
+    MCS51_INS_ATP,      /* ins  a, @dptr                */
+    MCS51_INS_ATA,      /* ins  a, @a+dptr              */
+    MCS51_INS_ATC,      /* ins  a, @a+pc                */
+
+    MCS51_INS_REG,      /* ins  reg                     */
+    MCS51_INS_REA,      /* ins  reg, a                  */
+    MCS51_INS_REI,      /* ins  reg, #immed             */
+    MCS51_INS_RIO,      /* ins  reg, #immed, offset     */
+    MCS51_INS_RED,      /* ins  reg, direct             */
+    MCS51_INS_REO,      /* ins  reg, offset             */
+
+    MCS51_INS_DIR,      /* ins  direct                  */
+    MCS51_INS_DIA,      /* ins  direct, a               */
+    MCS51_INS_DRE,      /* ins  direct, reg             */
+    MCS51_INS_DTR,      /* ins  direct, @reg            */
+    MCS51_INS_DII,      /* ins  direct, #immed          */
+    MCS51_INS_DID,      /* ins  direct, direct          */
+    MCS51_INS_DIO,      /* ins  direct, offset          */
+
+    MCS51_INS_PTR,      /* ins  dptr                    */
+    MCS51_INS_PTI,      /* ins  dptr, #immed            */
+
+    MCS51_INS_BIT,      /* ins  bit                     */
+    MCS51_INS_BIC,      /* ins  bit, c                  */
+    MCS51_INS_BIO,      /* ins  bit, offset             */
+
+    MCS51_INS_CON,      /* ins  c                       */
+    MCS51_INS_COB,      /* ins  c, bit                  */
+    MCS51_INS_COX,      /* ins  c, /bit                 */
+
+    MCS51_INS_TRE,      /* ins  @reg                    */
+    MCS51_INS_TRA,      /* ins  @reg, a                 */
+    MCS51_INS_TRI,      /* ins  @reg, #immed            */
+    MCS51_INS_TIO,      /* ins  @reg, #immed, offset    */
+    MCS51_INS_TRD,      /* ins  @reg, direct            */
+
+    MCS51_INS_TPA,      /* ins  @dptr, a                */
+    MCS51_INS_TAD,      /* ins  @a+dptr                 */
+    MCS51_INS_TPI,      /* ins  @dptr, #immed           */
+
+    MCS51_INS_OFF,      /* ins  offset                  */
+
+    MCS51_INS_A19,      /* ins  addr19                  */
+    MCS51_INS_A24,      /* ins  addr24                  */
+    MCS51_INS_PTL,      /* ins  dptr, #immed24          */
+};
+
+struct mcs51_ops {
+    uint8_t opcode;
+    uint8_t mask;
+    uint8_t reg;
+    unsigned int min;
+    unsigned int max;
+    unsigned int size;
+    enum mcs51_format format;
+    const char *name;
+};
+
+/**
+ * struct mcs51_variant - instruction set of one core.
+ * @name: name the core is selected by.
+ * @overlay: first mcs51_ext_table entry matched after mcs51_table.
+ * @nr_overlay: number of @overlay entries.
+ * @escape: escape byte, meaningful with @nr_escapes.
+ * @escapes: first mcs51_ext_table entry of the escape table.
+ * @nr_escapes: number of @escapes entries.
+ */
+struct mcs51_variant {
+    const char *name;
+    unsigned int overlay;
+    unsigned int nr_overlay;
+    uint8_t escape;
+    unsigned int escapes;
+    unsigned int nr_escapes;
+};
+
+#define MCS51_A11(data, ops)        ((((data)[0] & 0xe0) << 3) | (data)[1])
+#define MCS51_A16(data, ops)        (((data)[1] << 8) | (data)[2])
+#define MCS51_A19(data, ops)        ((((data)[0] & 0xe0) << 11) | ((data)[1] << 8) | (data)[2])
+#define MCS51_A24(data, ops)        (((data)[1] << 16) | ((data)[2] << 8) | (data)[3])
+#define MCS51_REG(data, ops)        ((((data)[0] & ~(ops)->mask) - (ops)->min))
+
+#endif  /* _MCS51_OPS_H_ */
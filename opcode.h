@@ -6,84 +6,19 @@
 #ifndef _OPCODE_H_
 #define _OPCODE_H_
 
-#include <stdint.h>
-
-enum mcs51_format { /* MCS-51 format table              */
-    MCS51_INS_NON,      /* ins                          */
-    MCS51_INS_A11,      /* ins  addr11                  */
-    MCS51_INS_A16,      /* ins  addr16                  */
-
-    MCS51_INS_ACC,      /* ins  a                       */
-    MCS51_INS_ACB,      /* ins  ab                      */
-    MCS51_INS_ACR,      /* ins  a, reg                  */
-    MCS51_INS_ATR,      /* ins  a, @reg                 */
-    MCS51_INS_ACI,      /* ins  a, #immed               */
-    MCS51_INS_AIO,      /* ins  a, #immed, offset       */
-    MCS51_INS_ACD,      /* ins  a, direct               */
-    MCS51_INS_ADO,      /* ins  a, direct, offset       */
-    MCS51_INS_ATP,      /* ins  a, @dptr                */
-    MCS51_INS_ATA,      /* ins  a, @a+dptr              */
-    MCS51_INS_ATC,      /* ins  a, @a+pc                */
-
-    MCS51_INS_REG,      /* ins  reg                     */
-    MCS51_INS_REA,      /* ins  reg, a                  */
-    MCS51_INS_REI,      /* ins  reg, #immed             */
-    MCS51_INS_RIO,      /* ins  reg, #immed, offset     */
-    MCS51_INS_RED,      /* ins  reg, direct             */
-    MCS51_INS_REO,      /* ins  reg, offset             */
-
-    MCS51_INS_DIR,      /* ins  direct                  */
-    MCS51_INS_DIA,      /* ins  direct, a               */
-    MCS51_INS_DRE,      /* ins  direct, reg             */
-    MCS51_INS_DTR,      /* ins  direct, @reg            */
-    MCS51_INS_DII,      /* ins  direct, #immed          */
-    MCS51_INS_DID,      /* ins  direct, direct          */
-    MCS51_INS_DIO,      /* ins  direct, offset          */
-
-    MCS51_INS_PTR,      /* ins  dptr                    */
-    MCS51_INS_PTI,      /* ins  dptr, #immed            */
-
-    MCS51_INS_BIT,      /* ins  bit                     */
-    MCS51_INS_BIC,      /* ins  bit, c                  */
-    MCS51_INS_BIO,      /* ins  bit, offset             */
-
-    MCS51_INS_CON,      /* ins  c                       */
-    MCS51_INS_COB,      /* ins  c, bit                  */
-    MCS51_INS_COX,      /* ins  c, /bit                 */
-
-    MCS51_INS_TRE,      /* ins  @reg                    */
-    MCS51_INS_TRA,      /* ins  @reg, a                 */
-    MCS51_INS_TRI,      /* ins  @reg, #immed            */
-    MCS51_INS_TIO,      /* ins  @reg, #immed, offset    */
-    MCS51_INS_TRD,      /* ins  @reg, direct            */
-
-    MCS51_INS_TPA,      /* ins  @dptr, a                */
-    MCS51_INS_TAD,      /* ins  @a+dptr                 */
-    MCS51_INS_TPI,      /* ins  @dptr, #immed           */
-
-    MCS51_INS_OFF,      /* ins  offset                  */
-};
+#include "mcs51-ops.h"
 
-struct mcs51_ops {
-    uint8_t opcode;
-    uint8_t mask;
-    uint8_t reg;
-    unsigned int min;
-    unsigned int max;
-    unsigned int size;
-    enum mcs51_format format;
-    const char *name;
-};
+/* The tables are defined here once, only mcs51-disasm.c includes this */
 
-static const char *mcs51_reg_name[] = {
+const char *const mcs51_reg_name[8] = {
     "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
 };
 
-static const char *mcs51_treg_name[] = {
+const char *const mcs51_treg_name[2] = {
     "@r0", "@r1"
 };
 
-static const struct mcs51_ops mcs51_table[] = {
+const struct mcs51_ops mcs51_table[] = {
     { 0x00, 0xff, 0x00, 0x0, 0x0, 1, MCS51_INS_NON, "nop"},     /* nop                              */
     { 0x01, 0x1f, 0x00, 0x0, 0x0, 2, MCS51_INS_A11, "ajmp"},    /* ajmp     addr11                  */
     { 0x02, 0xff, 0x00, 0x0, 0x0, 3, MCS51_INS_A16, "ljmp"},    /* ljmp     addr16                  */
@@ -212,8 +147,34 @@ static const struct mcs51_ops mcs51_table[] = {
     { 0xf8, 0xf0, 0x0f, 0x8, 0xf, 1, MCS51_INS_REA, "mov"},     /* mov      reg, a                  */
 };
 
-#define MCS51_A11(data, ops)        ((((data)[0] & 0xe0) << 3) | (data)[1])
-#define MCS51_A16(data, ops)        (((data)[1] << 8) | (data)[2])
-#define MCS51_REG(data, ops)        ((((data)[0] & ~(ops)->mask) - (ops)->min))
+/*
+ * Entries of the derivative cores, in the same description language.
+ * An overlay is matched after mcs51_table, so its entries replace the
+ * classic ones. An escape table describes the instruction following
+ * the escape byte, which adds one to its size.
+ */
+const struct mcs51_ops mcs51_ext_table[] = {
+    /* ds390: 24-bit contiguous mode */
+    { 0x01, 0x1f, 0x00, 0x0, 0x0, 3, MCS51_INS_A19, "ajmp"},    /* ajmp     addr19                  */
+    { 0x11, 0x1f, 0x00, 0x0, 0x0, 3, MCS51_INS_A19, "acall"},   /* acall    addr19                  */
+    { 0x02, 0xff, 0x00, 0x0, 0x0, 4, MCS51_INS_A24, "ljmp"},    /* ljmp     addr24                  */
+    { 0x12, 0xff, 0x00, 0x0, 0x0, 4, MCS51_INS_A24, "lcall"},   /* lcall    addr24                  */
+    { 0x90, 0xff, 0x00, 0x0, 0x0, 4, MCS51_INS_PTL, "mov"},     /* mov      dptr, #immed24          */
+
+    /* at89lp: 0xa5 escape, the dptr forms address /dptr */
+    { 0x00, 0xff, 0x00, 0x0, 0x0, 1, MCS51_INS_NON, "break"},   /* break                            */
+    { 0x73, 0xff, 0x00, 0x0, 0x0, 1, MCS51_INS_TAD, "jmp"},     /* jmp      @a+/dptr                */
+    { 0x90, 0xff, 0x00, 0x0, 0x0, 3, MCS51_INS_PTI, "mov"},     /* mov      /dptr, #immed           */
+    { 0x93, 0xff, 0x00, 0x0, 0x0, 1, MCS51_INS_ATA, "movc"},    /* movc     a, @a+/dptr             */
+    { 0xa3, 0xff, 0x00, 0x0, 0x0, 1, MCS51_INS_PTR, "inc"},     /* inc      /dptr                   */
+    { 0xe0, 0xff, 0x00, 0x0, 0x0, 1, MCS51_INS_ATP, "movx"},    /* movx     a, @/dptr               */
+    { 0xf0, 0xff, 0x00, 0x0, 0x0, 1, MCS51_INS_TPA, "movx"},    /* movx     @/dptr, a               */
+};
+
+const struct mcs51_variant mcs51_variant_table[] = {
+    { "8051",   0, 0, 0x00, 0, 0 },
+    { "ds390",  0, 5, 0x00, 0, 0 },
+    { "at89lp", 0, 0, 0xa5, 5, 7 },
+};
 
 #endif  /* _OPCODE_H_ */
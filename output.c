@@ -0,0 +1,316 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <endian.h>
+
+_Static_assert(sizeof(struct mcs51_record) == 24, "record layout changed");
+_Static_assert(sizeof(struct mcs51_record_head) == 16, "record header layout changed");
+
+/*
+ * Operands of each format in listing order, one character each:
+ * fixed registers A (a), B (ab), C (c), P (dptr), p (@dptr),
+ * X (@a+dptr), Y (@a+pc), and the variable r (reg), i (@reg),
+ * # (immed), d (direct), e (direct2), b (bit), / (inverted bit),
+ * o (offset), a (addr11/addr16), I (16-bit immediate), L (addr19/addr24)
+ * and J (24-bit immediate). The dptr forms of escaped instructions name
+ * the alternate /dptr.
+ */
+static const char *const output_operands[] = {
+    [MCS51_INS_NON] = "",   [MCS51_INS_A11] = "a",  [MCS51_INS_A16] = "a",
+    [MCS51_INS_ACC] = "A",  [MCS51_INS_ACB] = "B",  [MCS51_INS_ACR] = "Ar",
+    [MCS51_INS_ATR] = "Ai", [MCS51_INS_ACI] = "A#", [MCS51_INS_AIO] = "A#o",
+    [MCS51_INS_ACD] = "Ad", [MCS51_INS_ADO] = "Ado", [MCS51_INS_ATP] = "Ap",
+    [MCS51_INS_ATA] = "AX", [MCS51_INS_ATC] = "AY", [MCS51_INS_REG] = "r",
+    [MCS51_INS_REA] = "rA", [MCS51_INS_REI] = "r#", [MCS51_INS_RIO] = "r#o",
+    [MCS51_INS_RED] = "rd", [MCS51_INS_REO] = "ro", [MCS51_INS_DIR] = "d",
+    [MCS51_INS_DIA] = "dA", [MCS51_INS_DRE] = "dr", [MCS51_INS_DTR] = "di",
+    [MCS51_INS_DII] = "d#", [MCS51_INS_DID] = "de", [MCS51_INS_DIO] = "do",
+    [MCS51_INS_PTR] = "P",  [MCS51_INS_PTI] = "PI", [MCS51_INS_BIT] = "b",
+    [MCS51_INS_BIC] = "bC", [MCS51_INS_BIO] = "bo", [MCS51_INS_CON] = "C",
+    [MCS51_INS_COB] = "Cb", [MCS51_INS_COX] = "C/", [MCS51_INS_TRE] = "i",
+    [MCS51_INS_TRA] = "iA", [MCS51_INS_TRI] = "i#", [MCS51_INS_TIO] = "i#o",
+    [MCS51_INS_TRD] = "id", [MCS51_INS_TPA] = "pA", [MCS51_INS_TAD] = "X",
+    [MCS51_INS_TPI] = "p#", [MCS51_INS_OFF] = "o",  [MCS51_INS_A19] = "L",
+    [MCS51_INS_A24] = "L",  [MCS51_INS_PTL] = "PJ",
+};
+
+static inline char *put_str(char *buf, const char *str)
+{
+    while (*str)
+        *buf++ = *str++;
+    return buf;
+}
+
+static char *put_dec(char *buf, long value)
+{
+    char tmp[24], *walk = tmp + sizeof(tmp);
+    unsigned long mag = value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+    do
+        *--walk = '0' + mag % 10;
+    while (mag /= 10);
+
+    if (value < 0)
+        *buf++ = '-';
+
+    memcpy(buf, walk, tmp + sizeof(tmp) - walk);
+    return buf + (tmp + sizeof(tmp) - walk);
+}
+
+/* A quoted JSON string, symbol names come from user files */
+static char *put_json_str(char *buf, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint8_t ch;
+
+    *buf++ = '"';
+    while ((ch = *str++)) {
+        if (ch == '"' || ch == '\\') {
+            *buf++ = '\\';
+            *buf++ = ch;
+        } else if (ch < 0x20) {
+            buf = put_str(buf, "\\u00");
+            *buf++ = hex[ch >> 4];
+            *buf++ = hex[ch & 0xf];
+        } else {
+            *buf++ = ch;
+        }
+    }
+    *buf++ = '"';
+
+    return buf;
+}
+
+static char *put_key(char *buf, const char *key, long value)
+{
+    buf = put_str(buf, key);
+    return put_dec(buf, value);
+}
+
+static char *put_named(char *buf, const char *key, uint8_t value,
+                       const char (*names)[MCS51_SYMBOL_LEN])
+{
+    buf = put_key(buf, key, value);
+    if (names && names[value][0]) {
+        buf = put_str(buf, ",\"name\":");
+        buf = put_json_str(buf, names[value]);
+    }
+    return buf;
+}
+
+static char *put_operand(char *buf, char kind, const struct mcs51_insn *insn,
+                         const struct mcs51_symbols *sym)
+{
+    switch (kind) {
+        case 'A':
+            return put_str(buf, "\"a\"");
+
+        case 'B':
+            return put_str(buf, "\"ab\"");
+
+        case 'C':
+            return put_str(buf, "\"c\"");
+
+        case 'P':
+            return put_str(buf, insn->prefix ? "\"/dptr\"" : "\"dptr\"");
+
+        case 'p':
+            return put_str(buf, insn->prefix ? "\"@/dptr\"" : "\"@dptr\"");
+
+        case 'X':
+            return put_str(buf, insn->prefix ? "\"@a+/dptr\"" : "\"@a+dptr\"");
+
+        case 'Y':
+            return put_str(buf, "\"@a+pc\"");
+
+        case 'r':
+            buf = put_str(buf, "{\"reg\":\"r");
+            *buf++ = '0' + insn->reg;
+            return put_str(buf, "\"}");
+
+        case 'i':
+            buf = put_str(buf, "{\"ind\":\"r");
+            *buf++ = '0' + insn->reg;
+            return put_str(buf, "\"}");
+
+        case '#':
+            buf = put_key(buf, "{\"immed\":", insn->immed);
+            break;
+
+        case 'd':
+            buf = put_named(buf, "{\"direct\":", insn->direct, sym ? sym->direct : NULL);
+            break;
+
+        case 'e':
+            buf = put_named(buf, "{\"direct\":", insn->direct2, sym ? sym->direct : NULL);
+            break;
+
+        case 'b':
+            buf = put_named(buf, "{\"bit\":", insn->bit, sym ? sym->bit : NULL);
+            break;
+
+        case '/':
+            buf = put_named(buf, "{\"bit\":", insn->bit, sym ? sym->bit : NULL);
+            buf = put_str(buf, ",\"invert\":true");
+            break;
+
+        case 'o':
+            buf = put_key(buf, "{\"rel\":", insn->rel);
+            break;
+
+        case 'a':
+            buf = put_key(buf, "{\"addr\":", insn->addr16);
+            break;
+
+        case 'I':
+            buf = put_key(buf, "{\"immed\":", insn->addr16);
+            break;
+
+        case 'L':
+            buf = put_key(buf, "{\"addr\":", insn->addr24);
+            break;
+
+        case 'J':
+            buf = put_key(buf, "{\"immed\":", insn->addr24);
+            break;
+    }
+
+    *buf++ = '}';
+    return buf;
+}
+
+/**
+ * mcs51_emit_json - queue one instruction as a line of JSON.
+ * @emit: emitter to write to.
+ * @insn: instruction to render.
+ *
+ * Numbers are decimal. Operands are listed in assembler order, fixed
+ * registers as strings and everything else as an object naming its
+ * kind. Undecodable bytes have the mnemonic "byte" and no operands.
+ * Escaped instructions carry the escape byte as "prefix".
+ */
+void mcs51_emit_json(struct mcs51_emit *emit, const struct mcs51_insn *insn)
+{
+    const char *kind = insn->ops ? output_operands[insn->ops->format] : "";
+    char *buf, *walk;
+
+    walk = buf = mcs51_emit_reserve(emit, MCS51_JSON_MAX);
+    walk = put_key(walk, "{\"addr\":", insn->addr);
+    walk = put_key(walk, ",\"size\":", insn->size);
+    walk = put_key(walk, ",\"opcode\":", insn->opcode);
+    if (insn->prefix)
+        walk = put_key(walk, ",\"prefix\":", insn->prefix);
+    walk = put_str(walk, ",\"mnemonic\":\"");
+    walk = put_str(walk, insn->ops ? insn->ops->name : "byte");
+    walk = put_str(walk, "\",\"operands\":[");
+
+    for (; *kind; ++kind) {
+        walk = put_operand(walk, *kind, insn, emit->sym);
+        if (kind[1])
+            *walk++ = ',';
+    }
+
+    *walk++ = ']';
+    if (insn->flags & MCS51_INSN_BRANCH)
+        walk = put_key(walk, ",\"target\":", insn->target);
+    walk = put_key(walk, ",\"flags\":", insn->flags);
+    if (insn->flags & MCS51_INSN_LABEL) {
+        walk = put_str(walk, ",\"label\":\"");
+        walk += mcs51_format_label(walk, insn->addr);
+        *walk++ = '"';
+    }
+
+    *walk++ = '}';
+    *walk++ = '\n';
+    emit->len += walk - buf;
+}
+
+/**
+ * mcs51_emit_record - queue one instruction as a binary record.
+ * @emit: emitter to write to.
+ * @insn: instruction to store.
+ */
+void mcs51_emit_record(struct mcs51_emit *emit, const struct mcs51_insn *insn)
+{
+    struct mcs51_record record = { };
+
+    record.addr = htole32(insn->addr);
+    record.target = htole32(insn->target);
+    record.addr16 = htole16(insn->addr16);
+    record.opcode = insn->opcode;
+    record.size = insn->size;
+    record.index = insn->ops ? mcs51_ops_index(insn->ops) : 0xff;
+    record.format = insn->ops ? insn->ops->format : 0xff;
+    record.reg = insn->reg;
+    record.flags = insn->flags;
+    record.direct = insn->direct;
+    record.direct2 = insn->direct2;
+    record.immed = insn->immed;
+    record.bit = insn->bit;
+    record.rel = insn->rel;
+    record.prefix = insn->prefix;
+    record.addr_high = insn->addr24 >> 16;
+
+    memcpy(mcs51_emit_reserve(emit, sizeof(record)), &record, sizeof(record));
+    emit->len += sizeof(record);
+}
+
+/**
+ * mcs51_emit_begin - start an output stream.
+ * @emit: emitter to write to.
+ *
+ * Binary record streams open with a struct mcs51_record_head, the
+ * other formats need nothing.
+ */
+void mcs51_emit_begin(struct mcs51_emit *emit)
+{
+    struct mcs51_record_head head;
+
+    if (emit->output != MCS51_OUTPUT_BIN)
+        return;
+
+    memcpy(head.magic, MCS51_RECORD_MAGIC, sizeof(head.magic));
+    head.version = htole32(MCS51_RECORD_VERSION);
+    head.size = htole32(sizeof(struct mcs51_record));
+
+    memcpy(mcs51_emit_reserve(emit, sizeof(head)), &head, sizeof(head));
+    emit->len += sizeof(head);
+}
+
+/**
+ * mcs51_emit_file - introduce the listing of one file in a combined stream.
+ * @emit: emitter to write to.
+ * @name: name of the file.
+ *
+ * Text gets a "==> name <==" line and JSON a {"file": name} object.
+ * Binary records have no place for a name and get nothing.
+ */
+void mcs51_emit_file(struct mcs51_emit *emit, const char *name)
+{
+    char *buf, *walk;
+
+    walk = buf = mcs51_emit_reserve(emit, strlen(name) * 6 + 16);
+
+    switch (emit->output) {
+        case MCS51_OUTPUT_TEXT:
+            walk = put_str(walk, "==> ");
+            walk = put_str(walk, name);
+            walk = put_str(walk, " <==\n");
+            break;
+
+        case MCS51_OUTPUT_JSON:
+            walk = put_str(walk, "{\"file\":");
+            walk = put_json_str(walk, name);
+            walk = put_str(walk, "}\n");
+            break;
+
+        case MCS51_OUTPUT_BIN:
+            break;
+    }
+
+    emit->len += walk - buf;
+}
@@ -0,0 +1,212 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#define PARALLEL_CHUNK  (256UL << 10)
+#define PARALLEL_ROUND  2
+
+/* More threads than this only cost memory, each has two chunk buffers */
+#define PARALLEL_THREADS 64
+
+/* Buffers per writev call, POSIX only promises 16 */
+#ifdef UIO_MAXIOV
+# define PARALLEL_IOV   UIO_MAXIOV
+#else
+# define PARALLEL_IOV   16
+#endif
+
+/*
+ * Every chunk is sized with each entry an instruction stream can have
+ * (0 up to MCS51_INSN_MAX - 1 bytes into the chunk, depending on what
+ * the previous chunk ended with). Chaining those exits from offset
+ * zero gives the exact boundaries of a sequential run, so chunks are
+ * then rendered independently and written out in order.
+ */
+struct parallel_job {
+    const uint8_t *data;
+    size_t size;
+    uint32_t base;
+    const struct mcs51_symbols *sym;
+    size_t limit;
+    size_t first;
+    unsigned long next;
+    uint8_t (*exit)[MCS51_INSN_MAX];
+    uint8_t *entry;
+    struct mcs51_emit *emit;
+    void (*work)(struct parallel_job *job, size_t chunk);
+};
+
+static void parallel_sync(struct parallel_job *job, size_t chunk)
+{
+    size_t start, end, offset;
+    unsigned int entry;
+
+    start = chunk * PARALLEL_CHUNK;
+    end = start + PARALLEL_CHUNK;
+    if (end > job->size)
+        end = job->size;
+
+    for (entry = 0; entry < MCS51_INSN_MAX; ++entry) {
+        for (offset = start + entry; offset < end;)
+            offset += mcs51_insn_size(job->data + offset, job->size - offset);
+        job->exit[chunk][entry] = offset - end;
+    }
+}
+
+static void parallel_render(struct parallel_job *job, size_t chunk)
+{
+    struct mcs51_emit *emit = &job->emit[chunk - job->first];
+    size_t start, end;
+
+    start = chunk * PARALLEL_CHUNK;
+    end = start + PARALLEL_CHUNK;
+    if (end > job->size)
+        end = job->size;
+
+    emit->len = 0;
+    mcs51_emit_range(emit, job->data, job->size, start + job->entry[chunk], end, job->base);
+}
+
+static void *parallel_worker(void *pdata)
+{
+    struct parallel_job *job = pdata;
+    size_t chunk;
+
+    while ((chunk = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->limit)
+        job->work(job, chunk);
+
+    return NULL;
+}
+
+static void parallel_run(struct parallel_job *job, pthread_t *tids,
+                         unsigned int threads)
+{
+    unsigned int count;
+    int retval;
+
+    for (count = 1; count < threads; ++count) {
+        if ((retval = pthread_create(&tids[count], NULL, parallel_worker, job)))
+            errx(-1, "thread create err: %s", strerror(retval));
+    }
+
+    parallel_worker(job);
+
+    for (count = 1; count < threads; ++count)
+        pthread_join(tids[count], NULL);
+}
+
+static void parallel_write(int fd, struct iovec *iov, unsigned int count)
+{
+    ssize_t retval;
+
+    while (count) {
+        retval = writev(fd, iov, count < PARALLEL_IOV ? count : PARALLEL_IOV);
+        if (retval < 0) {
+            if (errno == EINTR)
+                continue;
+            err(-1, "output write err");
+        }
+
+        for (; count && (size_t)retval >= iov->iov_len; ++iov, --count)
+            retval -= iov->iov_len;
+
+        if (count) {
+            iov->iov_base += retval;
+            iov->iov_len -= retval;
+        }
+    }
+}
+
+/**
+ * mcs51_disasm_parallel - linear sweep of an image on several threads.
+ * @fd: file descriptor to write the listing to.
+ * @data: image to disassemble.
+ * @size: size of @data.
+ * @base: load address of @data.
+ * @threads: number of threads to use, capped by the number of chunks
+ *           and PARALLEL_THREADS.
+ * @sym: names for direct and bit operands, NULL for numbers only.
+ * @output: format of the listing.
+ *
+ * The listing is identical to a sequential mcs51_emit_range run.
+ */
+void mcs51_disasm_parallel(int fd, const uint8_t *data, size_t size,
+                           uint32_t base, unsigned int threads,
+                           const struct mcs51_symbols *sym,
+                           enum mcs51_output output)
+{
+    struct parallel_job job = {
+        .data = data,
+        .size = size,
+        .base = base,
+        .sym = sym,
+    };
+    struct iovec *iov;
+    pthread_t *tids;
+    size_t chunks, chunk, slots, count;
+
+    chunks = (size + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+    if (threads > PARALLEL_THREADS)
+        threads = PARALLEL_THREADS;
+    if (threads > chunks)
+        threads = chunks;
+    if (!threads)
+        threads = 1;
+    slots = threads * PARALLEL_ROUND;
+
+    job.exit = malloc(chunks * sizeof(*job.exit));
+    job.entry = malloc(chunks * sizeof(*job.entry));
+    job.emit = malloc(slots * sizeof(*job.emit));
+    tids = malloc(threads * sizeof(*tids));
+    iov = malloc(slots * sizeof(*iov));
+    if (!job.exit || !job.entry || !job.emit || !tids || !iov)
+        err(-1, "parallel job alloc err");
+
+    job.work = parallel_sync;
+    job.limit = chunks;
+    parallel_run(&job, tids, threads);
+
+    if (chunks)
+        job.entry[0] = 0;
+    for (chunk = 1; chunk < chunks; ++chunk)
+        job.entry[chunk] = job.exit[chunk - 1][job.entry[chunk - 1]];
+
+    for (count = 0; count < slots; ++count) {
+        mcs51_emit_init(&job.emit[count], -1, PARALLEL_CHUNK * 8);
+        job.emit[count].sym = sym;
+        job.emit[count].output = output;
+    }
+
+    job.work = parallel_render;
+    for (job.first = 0; job.first < chunks; job.first = job.limit) {
+        job.next = job.first;
+        job.limit = job.first + slots;
+        if (job.limit > chunks)
+            job.limit = chunks;
+        parallel_run(&job, tids, threads);
+
+        for (count = 0; count < job.limit - job.first; ++count) {
+            iov[count].iov_base = job.emit[count].buf;
+            iov[count].iov_len = job.emit[count].len;
+        }
+        parallel_write(fd, iov, count);
+    }
+
+    for (count = 0; count < slots; ++count)
+        mcs51_emit_exit(&job.emit[count]);
+
+    free(iov);
+    free(tids);
+    free(job.emit);
+    free(job.entry);
+    free(job.exit);
+}
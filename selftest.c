@@ -0,0 +1,648 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+/* Mismatches printed before a check only counts them */
+#define SELFTEST_REPORT 8
+
+/*
+ * The original decoder: a linear scan of mcs51_table followed by
+ * printf-style formatting straight from the instruction bytes. It is
+ * deliberately independent of mcs51_decode and mcs51_format_insn, so
+ * that any faster implementation is checked against the behaviour the
+ * listing has always had. Derivative cores scan their overlay after
+ * mcs51_table, and their escape table for an escape byte that does not
+ * decode on its own.
+ */
+static const struct mcs51_ops *reference_scan(const struct mcs51_ops *table,
+                                              unsigned int nr, uint8_t opcode)
+{
+    const struct mcs51_ops *walk, *ops;
+    unsigned int count, tmp;
+
+    for (count = 0, ops = NULL; count < nr; ++count) {
+        walk = &table[count];
+        if ((walk->opcode ^ opcode) & walk->mask)
+            continue;
+
+        tmp = opcode & walk->reg;
+        if (tmp < walk->min || walk->max < tmp)
+            continue;
+
+        ops = walk;
+    }
+
+    return ops;
+}
+
+static const struct mcs51_ops *reference_lookup(const struct mcs51_variant *variant,
+                                                uint8_t opcode)
+{
+    const struct mcs51_ops *ops;
+
+    ops = reference_scan(mcs51_ext_table + variant->overlay, variant->nr_overlay, opcode);
+    return ops ? ops : reference_scan(mcs51_table, mcs51_nr_table, opcode);
+}
+
+/* The core the decoder is set to */
+static const struct mcs51_variant *reference_variant(void)
+{
+    unsigned int index;
+
+    for (index = 0; index < mcs51_nr_variants; ++index)
+        if (!strcmp(mcs51_variant_table[index].name, mcs51_variant_name()))
+            break;
+
+    return &mcs51_variant_table[index];
+}
+
+/**
+ * reference_insn - render one instruction the original way.
+ * @buf: output, at least MCS51_LINE_MAX bytes.
+ * @ops: reference_lookup of @data[0].
+ * @escaped: @data follows an escape byte, dptr operands are /dptr.
+ * @data: instruction bytes.
+ * @len: number of valid bytes at @data, at least one.
+ *
+ * An instruction running past @len is listed as a data byte, as the
+ * bounded decoder does, where the original read past the buffer.
+ * Returns the instruction length.
+ */
+static int reference_insn(char *buf, const struct mcs51_ops *ops, bool escaped,
+                          const uint8_t *data, size_t len)
+{
+    const char *dptr = escaped ? "/dptr" : "dptr";
+    size_t size = MCS51_LINE_MAX;
+    int pos;
+
+    if (ops == NULL || ops->size > len) {
+        snprintf(buf, size, "\tbyte\t\t0x%02x", data[0]);
+        return 1;
+    }
+
+    pos = snprintf(buf, size, "\t%s", ops->name);
+    buf += pos;
+    size -= pos;
+
+    switch (ops->format) {
+        case MCS51_INS_NON:
+            break;
+
+        case MCS51_INS_A11:
+            snprintf(buf, size, "\t\t0x%03x", MCS51_A11(data, ops));
+            break;
+
+        case MCS51_INS_A16:
+            snprintf(buf, size, "\t\t0x%04x", MCS51_A16(data, ops));
+            break;
+
+        case MCS51_INS_A19:
+            snprintf(buf, size, "\t\t0x%05x", MCS51_A19(data, ops));
+            break;
+
+        case MCS51_INS_A24:
+            snprintf(buf, size, "\t\t0x%06x", MCS51_A24(data, ops));
+            break;
+
+        case MCS51_INS_ACC:
+            snprintf(buf, size, "\t\ta");
+            break;
+
+        case MCS51_INS_ACB:
+            snprintf(buf, size, "\t\tab");
+            break;
+
+        case MCS51_INS_ACR:
+            snprintf(buf, size, "\t\ta, %s", mcs51_reg_name[MCS51_REG(data, ops)]);
+            break;
+
+        case MCS51_INS_ATR:
+            snprintf(buf, size, "\t\ta, @%s", mcs51_treg_name[MCS51_REG(data, ops)]);
+            break;
+
+        case MCS51_INS_ACI:
+            snprintf(buf, size, "\t\ta, #0x%02x", data[1]);
+            break;
+
+        case MCS51_INS_AIO:
+            snprintf(buf, size, "\t\ta, #0x%02x, 0x%02x", data[1], data[2]);
+            break;
+
+        case MCS51_INS_ACD:
+            snprintf(buf, size, "\t\ta, 0x%02x", data[1]);
+            break;
+
+        case MCS51_INS_ADO:
+            snprintf(buf, size, "\t\ta, 0x%02x, 0x%02x", data[1], data[2]);
+            break;
+
+        case MCS51_INS_ATP:
+            snprintf(buf, size, "\t\ta, @%s", dptr);
+            break;
+
+        case MCS51_INS_ATA:
+            snprintf(buf, size, "\t\ta, @a+%s", dptr);
+            break;
+
+        case MCS51_INS_ATC:
+            snprintf(buf, size, "\t\ta, @a+pc");
+            break;
+
+        case MCS51_INS_REG:
+            snprintf(buf, size, "\t\t%s", mcs51_reg_name[MCS51_REG(data, ops)]);
+            break;
+
+        case MCS51_INS_REA:
+            snprintf(buf, size, "\t\t%s, a", mcs51_reg_name[MCS51_REG(data, ops)]);
+            break;
+
+        case MCS51_INS_REI:
+            snprintf(buf, size, "\t\t%s, #0x%02x", mcs51_reg_name[MCS51_REG(data, ops)], data[1]);
+            break;
+
+        case MCS51_INS_RIO:
+            snprintf(buf, size, "\t\t%s, #0x%02x, 0x%02x", mcs51_reg_name[MCS51_REG(data, ops)], data[1], data[2]);
+            break;
+
+        case MCS51_INS_RED:
+            snprintf(buf, size, "\t\t%s, 0x%02x", mcs51_reg_name[MCS51_REG(data, ops)], data[1]);
+            break;
+
+        case MCS51_INS_REO:
+            snprintf(buf, size, "\t\t%s, 0x%02x", mcs51_reg_name[MCS51_REG(data, ops)], data[1]);
+            break;
+
+        case MCS51_INS_DIR:
+            snprintf(buf, size, "\t\t0x%02x", data[1]);
+            break;
+
+        case MCS51_INS_DIA:
+            snprintf(buf, size, "\t\t0x%02x, a", data[1]);
+            break;
+
+        case MCS51_INS_DRE:
+            snprintf(buf, size, "\t\t0x%02x, %s", data[1], mcs51_reg_name[MCS51_REG(data, ops)]);
+            break;
+
+        case MCS51_INS_DTR:
+            snprintf(buf, size, "\t\t0x%02x, %s", data[1], mcs51_treg_name[MCS51_REG(data, ops)]);
+            break;
+
+        case MCS51_INS_DII:
+            snprintf(buf, size, "\t\t0x%02x, #0x%02x", data[1], data[2]);
+            break;
+
+        case MCS51_INS_DID:
+            snprintf(buf, size, "\t\t0x%02x, 0x%02x", data[1], data[2]);
+            break;
+
+        case MCS51_INS_DIO:
+            snprintf(buf, size, "\t\t0x%02x, 0x%02x", data[1], data[2]);
+            break;
+
+        case MCS51_INS_PTR:
+            snprintf(buf, size, "\t\t%s", dptr);
+            break;
+
+        case MCS51_INS_PTI:
+            snprintf(buf, size, "\t\t%s, 0x%02x", dptr, data[1]);
+            break;
+
+        case MCS51_INS_PTL:
+            snprintf(buf, size, "\t\tdptr, #0x%06x", MCS51_A24(data, ops));
+            break;
+
+        case MCS51_INS_BIT:
+            snprintf(buf, size, "\t\t0x%02x", data[1]);
+            break;
+
+        case MCS51_INS_BIC:
+            snprintf(buf, size, "\t\t0x%02x, c", data[1]);
+            break;
+
+        case MCS51_INS_BIO:
+            snprintf(buf, size, "\t\t0x%02x, 0x%02x", data[1], data[2]);
+            break;
+
+        case MCS51_INS_CON:
+            snprintf(buf, size, "\t\tc");
+            break;
+
+        case MCS51_INS_COB:
+            snprintf(buf, size, "\t\tc, 0x%02x", data[1]);
+            break;
+
+        case MCS51_INS_COX:
+            snprintf(buf, size, "\t\tc, /0x%02x", data[1]);
+            break;
+
+        case MCS51_INS_TRE:
+            snprintf(buf, size, "\t\t%s", mcs51_treg_name[MCS51_REG(data, ops)]);
+            break;
+
+        case MCS51_INS_TRA:
+            snprintf(buf, size, "\t\t%s, a", mcs51_treg_name[MCS51_REG(data, ops)]);
+            break;
+
+        case MCS51_INS_TRI:
+            snprintf(buf, size, "\t\t%s, #0x%02x", mcs51_treg_name[MCS51_REG(data, ops)], data[1]);
+            break;
+
+        case MCS51_INS_TIO:
+            snprintf(buf, size, "\t\t%s, #0x%02x, 0x%02x", mcs51_treg_name[MCS51_REG(data, ops)], data[1], data[2]);
+            break;
+
+        case MCS51_INS_TRD:
+            snprintf(buf, size, "\t\t%s, 0x%02x", mcs51_treg_name[MCS51_REG(data, ops)], data[1]);
+            break;
+
+        case MCS51_INS_TPA:
+            snprintf(buf, size, "\t\t@%s, a", dptr);
+            break;
+
+        case MCS51_INS_TAD:
+            snprintf(buf, size, "\t\t@a+%s", dptr);
+            break;
+
+        case MCS51_INS_TPI:
+            snprintf(buf, size, "\t\t@dptr, #0x%02x", data[1]);
+            break;
+
+        case MCS51_INS_OFF:
+            snprintf(buf, size, "\t\t0x%02x", data[1]);
+            break;
+
+        default:
+            snprintf(buf, size, "\t\tundecoded operands, inst is 0x%04x", data[0]);
+            break;
+    }
+
+    return ops->size;
+}
+
+/**
+ * reference_line - render the instruction at @data the original way.
+ * @buf: output, at least MCS51_LINE_MAX bytes.
+ * @variant: core to decode for.
+ * @ops: reference_lookup of @data[0].
+ * @data: instruction bytes.
+ * @len: number of valid bytes at @data, at least one.
+ *
+ * Returns the instruction length, escape included.
+ */
+static int reference_line(char *buf, const struct mcs51_variant *variant,
+                          const struct mcs51_ops *ops, const uint8_t *data, size_t len)
+{
+    const struct mcs51_ops *escaped;
+
+    if ((ops == NULL || ops->size > len) && variant->nr_escapes &&
+        data[0] == variant->escape && len > 1) {
+        escaped = reference_scan(mcs51_ext_table + variant->escapes,
+                                 variant->nr_escapes, data[1]);
+        if (escaped && escaped->size < len)
+            return reference_insn(buf, escaped, true, data + 1, len - 1) + 1;
+    }
+
+    return reference_insn(buf, ops, false, data, len);
+}
+
+/* Opcodes a derivative core decodes like the classic one are checked once */
+static bool selftest_same(const struct mcs51_variant *variant, unsigned int opcode)
+{
+    if (variant == mcs51_variant_table)
+        return false;
+
+    if (variant->nr_escapes && opcode == variant->escape)
+        return false;
+
+    return reference_lookup(variant, opcode) == reference_lookup(mcs51_variant_table, opcode);
+}
+
+static void selftest_mismatch(unsigned int *errors, const char *what,
+                              const uint8_t *data, size_t len,
+                              const char *expect, const char *actual)
+{
+    if (++*errors > SELFTEST_REPORT)
+        return;
+
+    fprintf(stderr, "%s %s: %02x %02x %02x %02x len %zu:\n  expect '%s'\n  actual '%s'\n",
+            mcs51_variant_name(), what, data[0], data[1], data[2], data[3], len,
+            expect, actual);
+}
+
+/*
+ * Every opcode with every pair of operand bytes, checked for length,
+ * mnemonic and operand text against the reference. The last byte of
+ * four byte instructions is derived from the pair.
+ */
+static unsigned int selftest_decode(const struct mcs51_variant *variant)
+{
+    const struct mcs51_ops *ops;
+    struct mcs51_insn insn;
+    char expect[MCS51_LINE_MAX], actual[MCS51_LINE_MAX];
+    uint8_t data[MCS51_INSN_MAX];
+    unsigned int opcode, operand, size, errors = 0;
+
+    for (opcode = 0; opcode < 256; ++opcode) {
+        if (selftest_same(variant, opcode))
+            continue;
+        ops = reference_lookup(variant, opcode);
+        data[0] = opcode;
+
+        for (operand = 0; operand < 0x10000; ++operand) {
+            data[1] = operand >> 8;
+            data[2] = operand;
+            data[3] = data[1] ^ data[2];
+
+            size = reference_line(expect, variant, ops, data, sizeof(data));
+            mcs51_decode(&insn, data, sizeof(data), 0);
+            mcs51_format_insn(actual, &insn, NULL);
+
+            if (insn.size != size || mcs51_insn_size(data, sizeof(data)) != size ||
+                strcmp(expect, actual))
+                selftest_mismatch(&errors, "decode", data, sizeof(data), expect, actual);
+        }
+    }
+
+    return errors;
+}
+
+/* Instructions cut short by the end of the buffer become data bytes */
+static unsigned int selftest_truncated(const struct mcs51_variant *variant)
+{
+    const struct mcs51_ops *ops;
+    struct mcs51_insn insn;
+    char expect[MCS51_LINE_MAX], actual[MCS51_LINE_MAX];
+    uint8_t data[MCS51_INSN_MAX] = { };
+    unsigned int opcode, len, errors = 0;
+
+    for (opcode = 0; opcode < 256; ++opcode) {
+        if (selftest_same(variant, opcode))
+            continue;
+        ops = reference_lookup(variant, opcode);
+        data[0] = opcode;
+
+        for (len = 1; len < MCS51_INSN_MAX; ++len) {
+            reference_line(expect, variant, ops, data, len);
+            mcs51_decode(&insn, data, len, 0);
+            mcs51_format_insn(actual, &insn, NULL);
+
+            if ((ops && ops->size > len && (insn.ops || insn.size != 1)) ||
+                mcs51_insn_size(data, len) != insn.size || strcmp(expect, actual))
+                selftest_mismatch(&errors, "truncated", data, len, expect, actual);
+        }
+    }
+
+    return errors;
+}
+
+/*
+ * print_insn_mcs51 over every opcode and operand byte. Its output is
+ * captured by pointing standard output at a temporary file.
+ */
+static unsigned int selftest_printf(const struct mcs51_variant *variant)
+{
+    const struct mcs51_ops *ops;
+    char expect[MCS51_LINE_MAX], actual[MCS51_LINE_MAX], printed[16];
+    uint8_t data[MCS51_INSN_MAX];
+    unsigned int opcode, operand, size, errors = 0;
+    FILE *capture;
+    int saved;
+
+    if (!(capture = tmpfile()))
+        err(-1, "selftest capture err");
+
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    dup2(fileno(capture), STDOUT_FILENO);
+
+    for (opcode = 0; opcode < 256; ++opcode) {
+        if (selftest_same(variant, opcode))
+            continue;
+        data[0] = opcode;
+        for (operand = 0; operand < 256; ++operand) {
+            data[1] = operand;
+            data[2] = operand ^ 0xa5;
+            data[3] = operand ^ 0x5a;
+            size = print_insn_mcs51(data, sizeof(data));
+            printf("\n%u\n", size);
+        }
+    }
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    rewind(capture);
+
+    for (opcode = 0; opcode < 256; ++opcode) {
+        if (selftest_same(variant, opcode))
+            continue;
+        ops = reference_lookup(variant, opcode);
+        data[0] = opcode;
+        for (operand = 0; operand < 256; ++operand) {
+            data[1] = operand;
+            data[2] = operand ^ 0xa5;
+            data[3] = operand ^ 0x5a;
+            size = reference_line(expect, variant, ops, data, sizeof(data));
+
+            if (!fgets(actual, sizeof(actual), capture))
+                actual[0] = '\0';
+            actual[strcspn(actual, "\n")] = '\0';
+            if (!fgets(printed, sizeof(printed), capture))
+                printed[0] = '\0';
+            if (strtoul(printed, NULL, 10) != size || strcmp(expect, actual))
+                selftest_mismatch(&errors, "printf", data, sizeof(data), expect, actual);
+        }
+    }
+
+    fclose(capture);
+    return errors;
+}
+
+/*
+ * Compiler switch idioms traced from four entries: an SDCC style ljmp
+ * table behind "add a,#n; jnc", a Keil style ajmp table behind
+ * "cjne a,#n,$+3; jnc", a movc a,@a+pc lookup and an ajmp table indexed
+ * by a loop counter, whose second entry is only reached once the state
+ * of the back edge is joined in. Entries inside each bound are followed
+ * or marked as data, the one just past it is not.
+ */
+static unsigned int selftest_tables(void)
+{
+    static const uint8_t image[] = {
+        0xef, 0x24, 0xfd, 0x50, 0x03, 0x02, 0x00, 0x1f,     /* 0x00 */
+        0xef, 0x2f, 0x2f, 0x90, 0x00, 0x10, 0x73, 0xa5,     /* 0x08 */
+        0x02, 0x00, 0x1c, 0x02, 0x00, 0x1d, 0x02, 0x00,     /* 0x10 */
+        0x1e, 0x02, 0x00, 0x1f, 0x22, 0x22, 0x22, 0x22,     /* 0x18 */
+        0xee, 0xb4, 0x02, 0x00, 0x50, 0x08, 0x90, 0x00,     /* 0x20 */
+        0x30, 0x23, 0x73, 0xa5, 0xa5, 0xa5, 0x22, 0xa5,     /* 0x28 */
+        0x01, 0x36, 0x01, 0x37, 0x01, 0x38, 0x22, 0x22,     /* 0x30 */
+        0x22, 0xa5, 0xa5, 0xa5, 0xa5, 0xa5, 0xa5, 0xa5,     /* 0x38 */
+        0x54, 0x03, 0x04, 0x83, 0x22, 0x11, 0x22, 0x33,     /* 0x40 */
+        0x44, 0xa5, 0xa5, 0xa5, 0xa5, 0xa5, 0xa5, 0xa5,     /* 0x48 */
+        0x7f, 0x00, 0xef, 0x23, 0x90, 0x00, 0x5a, 0x73,     /* 0x50 */
+        0xa5, 0xa5, 0x01, 0x60, 0x01, 0x64, 0x00, 0x00,     /* 0x58 */
+        0x0f, 0x01, 0x52, 0xa5, 0x0f, 0xbf, 0x02, 0xea,     /* 0x60 */
+        0x22, 0xa5,                                         /* 0x68 */
+    };
+    static const struct {
+        uint8_t addr;
+        bool code;
+        bool data;
+    } expect[] = {
+        { 0x10, true, false }, { 0x16, true, false }, { 0x19, false, false },
+        { 0x1c, true, false }, { 0x1e, true, false }, { 0x30, true, false },
+        { 0x32, true, false }, { 0x34, false, false }, { 0x37, true, false },
+        { 0x38, false, false }, { 0x44, true, false }, { 0x45, false, true },
+        { 0x48, false, true }, { 0x49, false, false }, { 0x58, false, false },
+        { 0x5c, true, false }, { 0x5e, false, false }, { 0x64, true, false },
+        { 0x68, true, false },
+    };
+    const struct mcs51_segment seg = { .addr = 0, .size = sizeof(image), .data = image };
+    struct mcs51_trace trace;
+    unsigned int index, errors = 0;
+
+    mcs51_trace_init(&trace, &seg, 1);
+    mcs51_trace_entry(&trace, 0x00);
+    mcs51_trace_entry(&trace, 0x20);
+    mcs51_trace_entry(&trace, 0x40);
+    mcs51_trace_entry(&trace, 0x50);
+    mcs51_trace_run(&trace);
+
+    for (index = 0; index < ARRAY_SIZE(expect); ++index) {
+        if (mcs51_bit_test(trace.code, expect[index].addr) == expect[index].code &&
+            mcs51_bit_test(trace.data, expect[index].addr) == expect[index].data)
+            continue;
+        if (++errors <= SELFTEST_REPORT)
+            fprintf(stderr, "tables: 0x%02x expect %s\n", expect[index].addr,
+                    expect[index].code ? "code" : expect[index].data ? "data" : "unreached");
+    }
+
+    mcs51_trace_release(&trace);
+    return errors;
+}
+
+/**
+ * mcs51_selftest - check the decoder against the reference implementation.
+ *
+ * Runs the exhaustive decode check, the truncation check and the
+ * print_insn_mcs51 check for every core, then the jump table check on
+ * the 8051 core, reporting each on standard error. Derivative cores only
+ * repeat the opcodes they change. The selected core is restored
+ * afterwards. Returns the number of mismatches.
+ */
+unsigned int mcs51_selftest(void)
+{
+    const struct mcs51_variant *variant, *active = reference_variant();
+    unsigned int decode = 0, truncated = 0, printed = 0, tables;
+
+    for (variant = mcs51_variant_table;
+         variant < mcs51_variant_table + mcs51_nr_variants; ++variant) {
+        mcs51_variant_select(variant->name);
+        decode += selftest_decode(variant);
+        truncated += selftest_truncated(variant);
+        printed += selftest_printf(variant);
+    }
+
+    mcs51_variant_select(mcs51_variant_table[0].name);
+    tables = selftest_tables();
+    mcs51_variant_select(active->name);
+
+    fprintf(stderr, "decode: %s\n", decode ? "FAILED" : "passed");
+    fprintf(stderr, "truncated: %s\n", truncated ? "FAILED" : "passed");
+    fprintf(stderr, "printf: %s\n", printed ? "FAILED" : "passed");
+    fprintf(stderr, "tables: %s\n", tables ? "FAILED" : "passed");
+
+    return decode + truncated + printed + tables;
+}
+
+/* The linear sweep listing of @data, produced by the reference */
+static void fuzz_reference(struct mcs51_emit *emit, const uint8_t *data, size_t size)
+{
+    const struct mcs51_variant *variant = reference_variant();
+    char line[MCS51_LINE_MAX], *buf;
+    size_t offset;
+    int len;
+
+    for (offset = 0; offset < size; offset += len) {
+        len = reference_line(line, variant, reference_lookup(variant, data[offset]),
+                             data + offset, size - offset);
+        buf = mcs51_emit_reserve(emit, MCS51_LINE_MAX + 16);
+        emit->len += sprintf(buf, "0x%04lx:%s\n", (unsigned long)offset, line);
+    }
+}
+
+static void fuzz_compare(const char *path, const struct mcs51_emit *expect,
+                         const struct mcs51_emit *actual)
+{
+    if (expect->len == actual->len && !memcmp(expect->buf, actual->buf, actual->len))
+        return;
+
+    fprintf(stderr, "fuzz: %s listing differs from the reference\n", path);
+    abort();
+}
+
+/**
+ * mcs51_fuzz_one - run one input through every linear sweep path.
+ * @data: image bytes, anything goes.
+ * @size: size of @data.
+ *
+ * The image is listed from memory and from a descriptor, and both
+ * listings must match the reference byte for byte. The memory path
+ * works on an exact-size copy, so a sanitizer catches any read past
+ * the end. Mismatches abort, which fuzzers report as a crash.
+ */
+int mcs51_fuzz_one(const uint8_t *data, size_t size)
+{
+    struct mcs51_emit expect, range, stream;
+    static FILE *input;
+    uint8_t *copy;
+    int fd;
+
+    if (!(copy = malloc(size ? size : 1)))
+        err(-1, "fuzz alloc err");
+    memcpy(copy, data, size);
+
+    if (!input && !(input = tmpfile()))
+        err(-1, "fuzz input err");
+    fd = fileno(input);
+    if (ftruncate(fd, 0) || pwrite(fd, copy, size, 0) != (ssize_t)size ||
+        lseek(fd, 0, SEEK_SET))
+        err(-1, "fuzz input write err");
+
+    mcs51_emit_init(&expect, -1, 4096);
+    mcs51_emit_init(&range, -1, 4096);
+    mcs51_emit_init(&stream, -1, 4096);
+
+    fuzz_reference(&expect, copy, size);
+    mcs51_emit_range(&range, copy, size, 0, size, 0);
+    mcs51_emit_stream(&stream, fd);
+
+    fuzz_compare("range", &expect, &range);
+    fuzz_compare("stream", &expect, &stream);
+
+    mcs51_emit_exit(&stream);
+    mcs51_emit_exit(&range);
+    mcs51_emit_exit(&expect);
+    free(copy);
+
+    return 0;
+}
+
+#ifdef MCS51_FUZZER
+/*
+ * libFuzzer entry, built without main.c by "make fuzz" into mcs51-fuzz.
+ * AFL drives the regular binary instead: mcs51-disasm --fuzz @@
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    return mcs51_fuzz_one(data, size);
+}
+#endif
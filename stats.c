@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <time.h>
+
+/* Instructions decoded, then formatted, between two clock reads */
+#define STATS_BLOCK     512
+
+/* Free buffer space that holds a formatted block without flushing */
+#define STATS_ROOM      (STATS_BLOCK * 512)
+
+static const char *const stats_format_name[] = {
+    [MCS51_INS_NON] = "non", [MCS51_INS_A11] = "a11", [MCS51_INS_A16] = "a16",
+    [MCS51_INS_ACC] = "acc", [MCS51_INS_ACB] = "acb", [MCS51_INS_ACR] = "acr",
+    [MCS51_INS_ATR] = "atr", [MCS51_INS_ACI] = "aci", [MCS51_INS_AIO] = "aio",
+    [MCS51_INS_ACD] = "acd", [MCS51_INS_ADO] = "ado", [MCS51_INS_ATP] = "atp",
+    [MCS51_INS_ATA] = "ata", [MCS51_INS_ATC] = "atc", [MCS51_INS_REG] = "reg",
+    [MCS51_INS_REA] = "rea", [MCS51_INS_REI] = "rei", [MCS51_INS_RIO] = "rio",
+    [MCS51_INS_RED] = "red", [MCS51_INS_REO] = "reo", [MCS51_INS_DIR] = "dir",
+    [MCS51_INS_DIA] = "dia", [MCS51_INS_DRE] = "dre", [MCS51_INS_DTR] = "dtr",
+    [MCS51_INS_DII] = "dii", [MCS51_INS_DID] = "did", [MCS51_INS_DIO] = "dio",
+    [MCS51_INS_PTR] = "ptr", [MCS51_INS_PTI] = "pti", [MCS51_INS_BIT] = "bit",
+    [MCS51_INS_BIC] = "bic", [MCS51_INS_BIO] = "bio", [MCS51_INS_CON] = "con",
+    [MCS51_INS_COB] = "cob", [MCS51_INS_COX] = "cox", [MCS51_INS_TRE] = "tre",
+    [MCS51_INS_TRA] = "tra", [MCS51_INS_TRI] = "tri", [MCS51_INS_TIO] = "tio",
+    [MCS51_INS_TRD] = "trd", [MCS51_INS_TPA] = "tpa", [MCS51_INS_TAD] = "tad",
+    [MCS51_INS_TPI] = "tpi", [MCS51_INS_OFF] = "off", [MCS51_INS_A19] = "a19",
+    [MCS51_INS_A24] = "a24", [MCS51_INS_PTL] = "ptl",
+};
+
+/**
+ * mcs51_stats_clock - monotonic time in seconds for the phase timers.
+ */
+double mcs51_stats_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * mcs51_stats_flush - write out pending output, timed as the write phase.
+ * @stats: counters to add to.
+ * @emit: emitter to flush.
+ */
+void mcs51_stats_flush(struct mcs51_stats *stats, struct mcs51_emit *emit)
+{
+    double start = mcs51_stats_clock();
+
+    mcs51_emit_flush(emit);
+    stats->phase[MCS51_PHASE_WRITE] += mcs51_stats_clock() - start;
+}
+
+/**
+ * mcs51_stats_range - mcs51_emit_range with phase timers and counters.
+ * @stats: counters to add to.
+ * @emit: emitter to write to.
+ * @data: start of the image.
+ * @size: size of @data, nothing past it is read.
+ * @start: offset of the first instruction.
+ * @end: offset to stop at.
+ * @base: load address of @data.
+ *
+ * A separate copy of the sweep, so the plain one carries no
+ * instrumentation at all. Instructions are decoded a block at a time
+ * and then formatted, so each phase is timed once per block. The
+ * output is identical to mcs51_emit_range.
+ */
+size_t mcs51_stats_range(struct mcs51_stats *stats, struct mcs51_emit *emit,
+                         const uint8_t *data, size_t size, size_t start,
+                         size_t end, uint32_t base)
+{
+    struct mcs51_insn block[STATS_BLOCK], *insn;
+    unsigned int count, index;
+    size_t offset;
+    double clock;
+
+    for (offset = start; offset < end;) {
+        clock = mcs51_stats_clock();
+
+        for (count = 0; count < STATS_BLOCK && offset < end; offset += insn->size) {
+            insn = &block[count++];
+            mcs51_decode(insn, data + offset, size - offset, base + offset);
+            stats->opcodes[data[offset]]++;
+            stats->formats[insn->ops ? insn->ops->format : MCS51_INS_PTL + 1]++;
+            stats->bytes += insn->size;
+        }
+
+        stats->insns += count;
+        stats->phase[MCS51_PHASE_DECODE] += mcs51_stats_clock() - clock;
+
+        if (emit->fd >= 0 && emit->size - emit->len < STATS_ROOM)
+            mcs51_stats_flush(stats, emit);
+
+        clock = mcs51_stats_clock();
+        for (index = 0; index < count; ++index)
+            mcs51_emit_insn(emit, &block[index]);
+        stats->phase[MCS51_PHASE_FORMAT] += mcs51_stats_clock() - clock;
+    }
+
+    return offset;
+}
+
+static void stats_row(const char *name, unsigned long count, unsigned long total)
+{
+    fprintf(stderr, "  %-12s %12lu %7.2f%%\n", name, count,
+            total ? count * 100.0 / total : 0.0);
+}
+
+/**
+ * mcs51_stats_report - print the phase times and histograms.
+ * @stats: counters to print.
+ *
+ * Goes to standard error. Opcodes are counted by the first byte of
+ * each instruction, escapes and undecodable bytes included.
+ */
+void mcs51_stats_report(const struct mcs51_stats *stats)
+{
+    static const char *const phase_name[] = {
+        [MCS51_PHASE_LOAD] = "load", [MCS51_PHASE_DECODE] = "decode",
+        [MCS51_PHASE_FORMAT] = "format", [MCS51_PHASE_WRITE] = "write",
+    };
+    struct mcs51_insn insn;
+    uint8_t data[MCS51_INSN_MAX] = { };
+    char name[32];
+    unsigned int index;
+    double total = 0;
+
+    for (index = 0; index < MCS51_PHASES; ++index)
+        total += stats->phase[index];
+
+    fprintf(stderr, "phases:\n");
+    for (index = 0; index < MCS51_PHASES; ++index)
+        fprintf(stderr, "  %-12s %12.3f ms %7.2f%%\n", phase_name[index],
+                stats->phase[index] * 1e3, total ? stats->phase[index] * 100 / total : 0.0);
+    fprintf(stderr, "  %-12s %12.3f ms %8.2f MB/s\n", "total", total * 1e3,
+            total ? stats->bytes / total / 1e6 : 0.0);
+    fprintf(stderr, "instructions: %lu in %lu bytes\n", stats->insns, stats->bytes);
+
+    fprintf(stderr, "formats:\n");
+    for (index = 0; index <= MCS51_INS_PTL + 1; ++index) {
+        if (stats->formats[index])
+            stats_row(index <= MCS51_INS_PTL ? stats_format_name[index] : "byte",
+                      stats->formats[index], stats->insns);
+    }
+
+    fprintf(stderr, "opcodes:\n");
+    for (index = 0; index < 256; ++index) {
+        if (!stats->opcodes[index])
+            continue;
+        data[0] = index;
+        mcs51_decode(&insn, data, sizeof(data), 0);
+        snprintf(name, sizeof(name), "0x%02x %s", index, insn.prefix ? "escape" :
+                 insn.ops ? insn.ops->name : "byte");
+        stats_row(name, stats->opcodes[index], stats->insns);
+    }
+}
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define STREAM_SIZE     (64UL << 10)
+#define STREAM_MASK     (STREAM_SIZE - 1)
+
+/**
+ * mcs51_emit_stream - linear sweep over a descriptor that cannot be mapped.
+ * @emit: emitter to write to.
+ * @fd: descriptor to read the image from, such as a pipe.
+ *
+ * Input goes through a fixed ring buffer, so memory use does not depend
+ * on the image size. Instructions wrapping around the end of the ring
+ * are copied out before decoding, and a truncated trailing instruction
+ * is listed byte by byte.
+ */
+void mcs51_emit_stream(struct mcs51_emit *emit, int fd)
+{
+    uint8_t ring[STREAM_SIZE], tmp[MCS51_INSN_MAX];
+    struct mcs51_insn insn;
+    size_t head = 0, tail = 0;
+    size_t index, avail, room;
+    const uint8_t *data;
+    ssize_t retval;
+    bool eof = false;
+
+    while (!eof) {
+        index = tail & STREAM_MASK;
+        room = STREAM_SIZE - (tail - head);
+        if (room > STREAM_SIZE - index)
+            room = STREAM_SIZE - index;
+
+        retval = read(fd, ring + index, room);
+        if (retval < 0) {
+            if (errno == EINTR)
+                continue;
+            err(-1, "input read err");
+        }
+
+        eof = !retval;
+        tail += retval;
+
+        while (tail - head >= MCS51_INSN_MAX || (eof && tail != head)) {
+            index = head & STREAM_MASK;
+            avail = tail - head;
+            if (avail > MCS51_INSN_MAX)
+                avail = MCS51_INSN_MAX;
+
+            data = ring + index;
+            if (STREAM_SIZE - index < avail) {
+                room = STREAM_SIZE - index;
+                memcpy(tmp, data, room);
+                memcpy(tmp + room, ring, avail - room);
+                data = tmp;
+            }
+
+            mcs51_decode(&insn, data, avail, head);
+            mcs51_emit_insn(emit, &insn);
+            head += insn.size;
+        }
+    }
+}
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <errno.h>
+
+struct symbol_entry {
+    uint8_t addr;
+    const char *name;
+};
+
+static const struct symbol_entry mcs51_sfr_8051[] = {
+    { 0x80, "P0"    }, { 0x81, "SP"    }, { 0x82, "DPL"   }, { 0x83, "DPH"   },
+    { 0x87, "PCON"  }, { 0x88, "TCON"  }, { 0x89, "TMOD"  }, { 0x8a, "TL0"   },
+    { 0x8b, "TL1"   }, { 0x8c, "TH0"   }, { 0x8d, "TH1"   }, { 0x90, "P1"    },
+    { 0x98, "SCON"  }, { 0x99, "SBUF"  }, { 0xa0, "P2"    }, { 0xa8, "IE"    },
+    { 0xb0, "P3"    }, { 0xb8, "IP"    }, { 0xd0, "PSW"   }, { 0xe0, "ACC"   },
+    { 0xf0, "B"     },
+};
+
+static const struct symbol_entry mcs51_bit_8051[] = {
+    { 0x88, "IT0"   }, { 0x89, "IE0"   }, { 0x8a, "IT1"   }, { 0x8b, "IE1"   },
+    { 0x8c, "TR0"   }, { 0x8d, "TF0"   }, { 0x8e, "TR1"   }, { 0x8f, "TF1"   },
+    { 0x98, "RI"    }, { 0x99, "TI"    }, { 0x9a, "RB8"   }, { 0x9b, "TB8"   },
+    { 0x9c, "REN"   }, { 0x9d, "SM2"   }, { 0x9e, "SM1"   }, { 0x9f, "SM0"   },
+    { 0xa8, "EX0"   }, { 0xa9, "ET0"   }, { 0xaa, "EX1"   }, { 0xab, "ET1"   },
+    { 0xac, "ES"    }, { 0xaf, "EA"    }, { 0xb0, "RXD"   }, { 0xb1, "TXD"   },
+    { 0xb2, "INT0"  }, { 0xb3, "INT1"  }, { 0xb4, "T0"    }, { 0xb5, "T1"    },
+    { 0xb6, "WR"    }, { 0xb7, "RD"    }, { 0xb8, "PX0"   }, { 0xb9, "PT0"   },
+    { 0xba, "PX1"   }, { 0xbb, "PT1"   }, { 0xbc, "PS"    }, { 0xd0, "P"     },
+    { 0xd2, "OV"    }, { 0xd3, "RS0"   }, { 0xd4, "RS1"   }, { 0xd5, "F0"    },
+    { 0xd6, "AC"    }, { 0xd7, "CY"    },
+};
+
+static const struct symbol_entry mcs51_sfr_8052[] = {
+    { 0xc8, "T2CON" }, { 0xc9, "T2MOD" }, { 0xca, "RCAP2L"}, { 0xcb, "RCAP2H"},
+    { 0xcc, "TL2"   }, { 0xcd, "TH2"   },
+};
+
+static const struct symbol_entry mcs51_bit_8052[] = {
+    { 0xad, "ET2"   }, { 0xbd, "PT2"   }, { 0xc8, "CP_RL2"}, { 0xc9, "C_T2"  },
+    { 0xca, "TR2"   }, { 0xcb, "EXEN2" }, { 0xcc, "TCLK"  }, { 0xcd, "RCLK"  },
+    { 0xce, "EXF2"  }, { 0xcf, "TF2"   },
+};
+
+static void symbols_apply(char (*table)[MCS51_SYMBOL_LEN],
+                          const struct symbol_entry *entry, size_t count)
+{
+    while (count--) {
+        strcpy(table[entry->addr], entry->name);
+        ++entry;
+    }
+}
+
+/*
+ * Bits of bit-addressable SFRs (those at multiples of eight) without a
+ * name of their own are called after their register, such as "ACC.7".
+ * Names made here are remade on every call, so they follow a register
+ * renamed by a later file.
+ */
+static void symbols_fill_bits(struct mcs51_symbols *sym)
+{
+    unsigned int addr;
+    const char *reg;
+    size_t len;
+
+    for (addr = 0x80; addr < 0x100; ++addr) {
+        if (sym->bit[addr][0] && !mcs51_bit_test(sym->generated, addr))
+            continue;
+
+        sym->bit[addr][0] = '\0';
+        mcs51_bit_clear(sym->generated, addr);
+
+        reg = sym->direct[addr & 0xf8];
+        len = strlen(reg);
+        if (!len || len + 3 > MCS51_SYMBOL_LEN)
+            continue;
+        memcpy(sym->bit[addr], reg, len);
+        sym->bit[addr][len] = '.';
+        sym->bit[addr][len + 1] = '0' + (addr & 7);
+        sym->bit[addr][len + 2] = '\0';
+        mcs51_bit_set(sym->generated, addr);
+    }
+}
+
+/**
+ * mcs51_symbols_builtin - select a built-in dialect.
+ * @sym: table to fill, previous contents are dropped.
+ * @dialect: "8051" or "8052".
+ *
+ * Returns 0, or -ENOENT for an unknown dialect.
+ */
+int mcs51_symbols_builtin(struct mcs51_symbols *sym, const char *dialect)
+{
+    bool is8052;
+
+    if (!strcmp(dialect, "8051"))
+        is8052 = false;
+    else if (!strcmp(dialect, "8052"))
+        is8052 = true;
+    else
+        return -ENOENT;
+
+    memset(sym, 0, sizeof(*sym));
+    symbols_apply(sym->direct, mcs51_sfr_8051, ARRAY_SIZE(mcs51_sfr_8051));
+    symbols_apply(sym->bit, mcs51_bit_8051, ARRAY_SIZE(mcs51_bit_8051));
+
+    if (is8052) {
+        symbols_apply(sym->direct, mcs51_sfr_8052, ARRAY_SIZE(mcs51_sfr_8052));
+        symbols_apply(sym->bit, mcs51_bit_8052, ARRAY_SIZE(mcs51_bit_8052));
+    }
+
+    symbols_fill_bits(sym);
+    return 0;
+}
+
+/**
+ * mcs51_symbols_load - add names from a variant description.
+ * @sym: table to add to.
+ * @text: file contents.
+ * @size: size of @text.
+ * @line: filled with the offending line on error.
+ *
+ * Every non-empty line is "sfr NAME ADDR" or "bit NAME ADDR", with
+ * anything after '#' ignored. Entries replace earlier names at the same
+ * address, so a derivative file is loaded on top of a built-in dialect.
+ * Returns 0 or -EINVAL.
+ */
+int mcs51_symbols_load(struct mcs51_symbols *sym, const char *text, size_t size,
+                       unsigned long *line)
+{
+    const char *end = text + size, *walk, *next;
+    char kind[8], name[MCS51_SYMBOL_LEN], buf[128];
+    int count, addr;
+    size_t len;
+
+    for (*line = 1, walk = text; walk < end; walk = next + 1, ++*line) {
+        if (!(next = memchr(walk, '\n', end - walk)))
+            next = end;
+
+        len = next - walk;
+        if (len >= sizeof(buf))
+            return -EINVAL;
+        memcpy(buf, walk, len);
+        buf[len] = '\0';
+        buf[strcspn(buf, "#\r")] = '\0';
+
+        count = sscanf(buf, "%7s %15s %i", kind, name, &addr);
+        if (count <= 0)
+            continue;
+        if (count != 3 || addr < 0 || addr > 0xff)
+            return -EINVAL;
+
+        if (!strcmp(kind, "sfr"))
+            strcpy(sym->direct[addr], name);
+        else if (!strcmp(kind, "bit")) {
+            strcpy(sym->bit[addr], name);
+            mcs51_bit_clear(sym->generated, addr);
+        }
+        else
+            return -EINVAL;
+    }
+
+    symbols_fill_bits(sym);
+    return 0;
+}
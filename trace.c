@@ -0,0 +1,355 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <err.h>
+
+/* Widenings of one state before growing intervals are given up on */
+#define TRACE_JOINS 8
+
+/* Reset and interrupt vectors of the 8051/8052 */
+static const uint32_t trace_vectors[] = {
+    0x0000, 0x0003, 0x000b, 0x0013, 0x001b, 0x0023, 0x002b,
+};
+
+/**
+ * mcs51_trace_locate - map an address to its bit index in a trace.
+ * @trace: trace to look up in.
+ * @addr: address to look up.
+ * @avail: filled with the number of image bytes from @addr onwards.
+ *
+ * Returns the bit index, or -1 when @addr is outside every segment.
+ */
+long mcs51_trace_locate(struct mcs51_trace *trace, uint32_t addr, size_t *avail)
+{
+    const struct mcs51_segment *seg;
+    size_t low, high, mid;
+
+    if (!trace->nr_segs)
+        return -1;
+
+    seg = &trace->segs[trace->last];
+    if (addr < seg->addr || addr - seg->addr >= seg->size) {
+        for (low = 0, high = trace->nr_segs; low < high;) {
+            mid = (low + high) / 2;
+            if (trace->segs[mid].addr <= addr)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        if (!low)
+            return -1;
+
+        seg = &trace->segs[low - 1];
+        if (addr - seg->addr >= seg->size)
+            return -1;
+        trace->last = low - 1;
+    }
+
+    if (avail)
+        *avail = seg->size - (addr - seg->addr);
+
+    return trace->base[trace->last] + (addr - seg->addr);
+}
+
+static void trace_push(struct mcs51_trace *trace, uint32_t addr,
+                       const struct mcs51_emu *emu)
+{
+    struct mcs51_trace_work *work;
+
+    if (trace->nr_work == trace->max_work) {
+        trace->max_work = trace->max_work ? trace->max_work * 2 : 256;
+        trace->work = realloc(trace->work, trace->max_work * sizeof(*trace->work));
+        if (!trace->work)
+            err(-1, "trace worklist alloc err");
+    }
+
+    work = &trace->work[trace->nr_work++];
+    work->addr = addr;
+    if (emu)
+        work->emu = *emu;
+    else
+        mcs51_emu_reset(&work->emu);
+}
+
+/**
+ * trace_arrive - join the state of a path reaching an instruction.
+ * @trace: trace being run.
+ * @index: bit index of the instruction.
+ * @emu: state of the arriving path, replaced by the joined state.
+ *
+ * Returns false when the instruction was reached before with a state
+ * that already covers @emu, so walking on would find nothing new.
+ */
+static bool trace_arrive(struct mcs51_trace *trace, long index, struct mcs51_emu *emu)
+{
+    struct mcs51_trace_state *state;
+
+    if (trace->slot[index]) {
+        state = &trace->states[trace->slot[index] - 1];
+        if (!mcs51_emu_join(&state->emu, emu, state->joins >= TRACE_JOINS))
+            return false;
+        state->joins++;
+        *emu = state->emu;
+        return true;
+    }
+
+    if (trace->nr_states == trace->max_states) {
+        trace->max_states = trace->max_states ? trace->max_states * 2 : 256;
+        trace->states = realloc(trace->states, trace->max_states * sizeof(*trace->states));
+        if (!trace->states)
+            err(-1, "trace state alloc err");
+    }
+
+    state = &trace->states[trace->nr_states++];
+    state->emu = *emu;
+    state->joins = 0;
+    trace->slot[index] = trace->nr_states;
+    return true;
+}
+
+/**
+ * trace_movc - mark a bounded movc table as data.
+ * @trace: trace being run.
+ * @emu: state after the movc, A becomes the range of the table bytes.
+ * @base: table address.
+ * @lo: lowest index.
+ * @hi: highest index.
+ */
+static void trace_movc(struct mcs51_trace *trace, struct mcs51_emu *emu,
+                       uint32_t base, unsigned int lo, unsigned int hi)
+{
+    unsigned int offset, min = 0xff, max = 0;
+    const uint8_t *data;
+    long index;
+
+    for (offset = lo; offset <= hi; ++offset) {
+        if ((index = mcs51_trace_locate(trace, base + offset, NULL)) < 0)
+            return;
+
+        data = trace->segs[trace->last].data;
+        data += base + offset - trace->segs[trace->last].addr;
+        if (*data < min)
+            min = *data;
+        if (*data > max)
+            max = *data;
+
+        mcs51_bit_set(trace->data, index);
+    }
+
+    mcs51_emu_load(emu, min, max);
+}
+
+/* Size of the unconditional jump at @addr, 0 when there is none */
+static unsigned int trace_jump(struct mcs51_trace *trace, uint32_t addr)
+{
+    struct mcs51_insn insn;
+    size_t avail;
+
+    if (mcs51_trace_locate(trace, addr, &avail) < 0)
+        return 0;
+
+    mcs51_decode(&insn, trace->segs[trace->last].data + (addr -
+                 trace->segs[trace->last].addr), avail, addr);
+    if (!insn.ops || (insn.flags & (MCS51_INSN_BRANCH | MCS51_INSN_STOP)) !=
+        (MCS51_INSN_BRANCH | MCS51_INSN_STOP) || (insn.flags & MCS51_INSN_CALL))
+        return 0;
+
+    return insn.size;
+}
+
+/**
+ * trace_table - follow every entry of a bounded jmp @a+dptr table.
+ * @trace: trace being run.
+ * @emu: state at the jmp, every entry is reached with it.
+ * @base: table address.
+ * @lo: lowest index.
+ * @hi: highest index.
+ *
+ * Compilers fill these tables with ajmp, ljmp or sjmp instructions of
+ * one size, and scale the index by it. The first entry gives the size,
+ * entries are followed up to the first index in range that does not
+ * start a jump of that size. When the first entry is not a jump only a
+ * constant index is followed.
+ */
+static void trace_table(struct mcs51_trace *trace, const struct mcs51_emu *emu,
+                        uint32_t base, unsigned int lo, unsigned int hi)
+{
+    unsigned int offset, stride;
+
+    if (!(stride = trace_jump(trace, base + lo))) {
+        if (lo == hi)
+            trace_push(trace, base + lo, emu);
+        return;
+    }
+
+    for (offset = lo; offset <= hi; offset += stride) {
+        if (trace_jump(trace, base + offset) != stride)
+            break;
+        trace_push(trace, base + offset, emu);
+    }
+}
+
+static void trace_walk(struct mcs51_trace *trace, uint32_t addr, struct mcs51_emu *emu)
+{
+    struct mcs51_emu taken;
+    struct mcs51_insn insn;
+    unsigned int lo, hi;
+    const uint8_t *data;
+    uint32_t base;
+    size_t avail;
+    long index;
+    bool table;
+
+    for (;;) {
+        if ((index = mcs51_trace_locate(trace, addr, &avail)) < 0)
+            return;
+
+        data = trace->segs[trace->last].data + (addr - trace->segs[trace->last].addr);
+        mcs51_decode(&insn, data, avail, addr);
+        if (!insn.ops || !trace_arrive(trace, index, emu))
+            return;
+
+        mcs51_bit_set(trace->code, index);
+
+        table = mcs51_emu_table(emu, &insn, &base, &lo, &hi);
+        if (table && insn.ops->format == MCS51_INS_TAD)
+            trace_table(trace, emu, base, lo, hi);
+
+        mcs51_emu_step(emu, &taken, &insn);
+        if (table && insn.ops->format != MCS51_INS_TAD)
+            trace_movc(trace, emu, base, lo, hi);
+
+        if (insn.flags & MCS51_INSN_BRANCH)
+            trace_push(trace, insn.target, &taken);
+
+        if (insn.flags & MCS51_INSN_STOP)
+            return;
+
+        addr += insn.size;
+    }
+}
+
+/**
+ * mcs51_trace_init - prepare a recursive traversal of an image.
+ * @trace: trace to set up.
+ * @segs: image segments sorted by address.
+ * @nr_segs: number of @segs.
+ */
+void mcs51_trace_init(struct mcs51_trace *trace, const struct mcs51_segment *segs,
+                      size_t nr_segs)
+{
+    size_t index, bits;
+
+    memset(trace, 0, sizeof(*trace));
+    trace->segs = segs;
+    trace->nr_segs = nr_segs;
+
+    if (!(trace->base = malloc((nr_segs + 1) * sizeof(*trace->base))))
+        err(-1, "trace alloc err");
+
+    for (index = bits = 0; index < nr_segs; ++index) {
+        trace->base[index] = bits;
+        bits += segs[index].size;
+    }
+
+    trace->bits = bits;
+    trace->code = calloc(MCS51_BITMAP_LONGS(bits), sizeof(unsigned long));
+    trace->data = calloc(MCS51_BITMAP_LONGS(bits), sizeof(unsigned long));
+    trace->slot = calloc(bits, sizeof(*trace->slot));
+    if (!trace->code || !trace->data || !trace->slot)
+        err(-1, "trace bitmap alloc err");
+}
+
+void mcs51_trace_release(struct mcs51_trace *trace)
+{
+    free(trace->work);
+    free(trace->states);
+    free(trace->slot);
+    free(trace->data);
+    free(trace->code);
+    free(trace->base);
+}
+
+/**
+ * mcs51_trace_entry - add an entry point to follow.
+ * @trace: trace to add to.
+ * @addr: code address reached from outside the image.
+ */
+void mcs51_trace_entry(struct mcs51_trace *trace, uint32_t addr)
+{
+    trace_push(trace, addr, NULL);
+}
+
+/**
+ * mcs51_trace_run - follow control flow from every pending entry.
+ * @trace: trace to run.
+ *
+ * Without explicit entries the reset and interrupt vectors are used.
+ * Every instruction keeps the join of the machine states of the paths
+ * reaching it, and is walked again whenever that join widens. The
+ * joined state resolves jmp @a+dptr tables and marks movc tables as
+ * data where the base and the index are bounded.
+ */
+void mcs51_trace_run(struct mcs51_trace *trace)
+{
+    struct mcs51_trace_work work;
+    unsigned int count;
+
+    if (!trace->nr_work) {
+        for (count = 0; count < ARRAY_SIZE(trace_vectors); ++count)
+            trace_push(trace, trace_vectors[count], NULL);
+    }
+
+    while (trace->nr_work) {
+        work = trace->work[--trace->nr_work];
+        trace_walk(trace, work.addr, &work.emu);
+    }
+}
+
+/**
+ * mcs51_trace_byte - fill the record of a byte the trace did not reach.
+ * @trace: trace that has been run.
+ * @insn: record to fill.
+ * @index: segment holding the byte.
+ * @offset: offset of the byte in its segment.
+ */
+void mcs51_trace_byte(const struct mcs51_trace *trace, struct mcs51_insn *insn,
+                      size_t index, size_t offset)
+{
+    const struct mcs51_segment *seg = &trace->segs[index];
+
+    mcs51_decode_byte(insn, seg->data[offset], seg->addr + offset);
+    if (mcs51_bit_test(trace->data, trace->base[index] + offset))
+        insn->flags |= MCS51_INSN_DATA;
+}
+
+/**
+ * mcs51_trace_emit - list an image after tracing it.
+ * @trace: trace that has been run.
+ * @emit: emitter to write to.
+ *
+ * Instructions reached by the trace are disassembled, every other byte
+ * is listed as data, with MCS51_INSN_DATA where a movc table holds it.
+ */
+void mcs51_trace_emit(struct mcs51_trace *trace, struct mcs51_emit *emit)
+{
+    const struct mcs51_segment *seg;
+    struct mcs51_insn insn;
+    size_t index, offset;
+
+    for (index = 0; index < trace->nr_segs; ++index) {
+        seg = &trace->segs[index];
+        for (offset = 0; offset < seg->size; offset += insn.size) {
+            if (mcs51_bit_test(trace->code, trace->base[index] + offset))
+                mcs51_decode(&insn, seg->data + offset, seg->size - offset,
+                             seg->addr + offset);
+            else
+                mcs51_trace_byte(trace, &insn, index, offset);
+            mcs51_emit_insn(emit, &insn);
+        }
+    }
+}
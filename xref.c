@@ -0,0 +1,407 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright(c) 2021 Sanpe <sanpeqf@gmail.com>
+ */
+
+#include "mcs51-disasm.h"
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <endian.h>
+
+/* Reset vector, always a call graph node */
+#define XREF_RESET      0x0000
+
+/* Entries copied per reservation when saving */
+#define XREF_CHUNK      4096
+
+static const char *const xref_kind_name[] = {
+    [MCS51_XREF_CALL]   = "call",
+    [MCS51_XREF_JUMP]   = "jump",
+    [MCS51_XREF_DIRECT] = "direct",
+    [MCS51_XREF_BIT]    = "bit",
+    [MCS51_XREF_DPTR]   = "dptr",
+};
+
+/**
+ * struct xref_build - references collected during the decode pass.
+ * @refs: one growable array per kind, entries stored little-endian.
+ * @nr_refs: number of valid entries of each @refs.
+ * @max_refs: allocated size of each @refs.
+ */
+struct xref_build {
+    struct mcs51_xref_entry *refs[MCS51_XREF_KINDS];
+    size_t nr_refs[MCS51_XREF_KINDS];
+    size_t max_refs[MCS51_XREF_KINDS];
+};
+
+static inline uint32_t xref_to(const struct mcs51_xref_entry *entry)
+{
+    return le32toh(entry->to);
+}
+
+static inline uint32_t xref_from(const struct mcs51_xref_entry *entry)
+{
+    return le32toh(entry->from);
+}
+
+static void xref_add(struct xref_build *build, enum mcs51_xref_kind kind,
+                     uint32_t to, uint32_t from)
+{
+    struct mcs51_xref_entry *entry;
+
+    if (build->nr_refs[kind] == build->max_refs[kind]) {
+        build->max_refs[kind] = build->max_refs[kind] ? build->max_refs[kind] * 2 : 1024;
+        build->refs[kind] = realloc(build->refs[kind],
+                                    build->max_refs[kind] * sizeof(*entry));
+        if (!build->refs[kind])
+            err(-1, "xref alloc err");
+    }
+
+    entry = &build->refs[kind][build->nr_refs[kind]++];
+    entry->to = htole32(to);
+    entry->from = htole32(from);
+}
+
+static void xref_insn(struct xref_build *build, const struct mcs51_insn *insn)
+{
+    if (!insn->ops)
+        return;
+
+    if (insn->flags & MCS51_INSN_BRANCH)
+        xref_add(build, insn->flags & MCS51_INSN_CALL ? MCS51_XREF_CALL :
+                 MCS51_XREF_JUMP, insn->target, insn->addr);
+
+    switch (insn->ops->format) {
+        case MCS51_INS_ACD: case MCS51_INS_ADO: case MCS51_INS_RED:
+        case MCS51_INS_DIR: case MCS51_INS_DIA: case MCS51_INS_DRE:
+        case MCS51_INS_DTR: case MCS51_INS_DII: case MCS51_INS_DIO:
+            xref_add(build, MCS51_XREF_DIRECT, insn->direct, insn->addr);
+            break;
+
+        case MCS51_INS_DID:
+            xref_add(build, MCS51_XREF_DIRECT, insn->direct, insn->addr);
+            xref_add(build, MCS51_XREF_DIRECT, insn->direct2, insn->addr);
+            break;
+
+        case MCS51_INS_BIT: case MCS51_INS_BIC: case MCS51_INS_BIO:
+        case MCS51_INS_COB: case MCS51_INS_COX:
+            xref_add(build, MCS51_XREF_BIT, insn->bit, insn->addr);
+            break;
+
+        case MCS51_INS_PTI:
+            xref_add(build, MCS51_XREF_DPTR, insn->addr16, insn->addr);
+            break;
+
+        case MCS51_INS_PTL:
+            xref_add(build, MCS51_XREF_DPTR, insn->addr24, insn->addr);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static int xref_cmp(const void *pa, const void *pb)
+{
+    const struct mcs51_xref_entry *a = pa, *b = pb;
+
+    if (xref_to(a) != xref_to(b))
+        return xref_to(a) < xref_to(b) ? -1 : 1;
+    return xref_from(a) < xref_from(b) ? -1 : xref_from(a) > xref_from(b);
+}
+
+/**
+ * mcs51_xref_build - collect the references of an image in one pass.
+ * @xref: tables to fill.
+ * @segs: image segments sorted by address.
+ * @nr_segs: number of @segs.
+ * @trace: finished trace to take code from, NULL to sweep linearly.
+ *
+ * Every kind is sorted by target then source and packed behind the
+ * previous one, so @xref->first works as the row index of a CSR table.
+ */
+void mcs51_xref_build(struct mcs51_xref *xref, const struct mcs51_segment *segs,
+                      size_t nr_segs, const struct mcs51_trace *trace)
+{
+    struct xref_build build = { };
+    struct mcs51_insn insn;
+    size_t index, offset, total;
+    unsigned int kind;
+
+    memset(xref, 0, sizeof(*xref));
+
+    for (index = 0; index < nr_segs; ++index) {
+        for (offset = 0; offset < segs[index].size; offset += insn.size) {
+            if (trace && !mcs51_bit_test(trace->code, trace->base[index] + offset)) {
+                insn.size = 1;
+                continue;
+            }
+            mcs51_decode(&insn, segs[index].data + offset, segs[index].size - offset,
+                         segs[index].addr + offset);
+            xref_insn(&build, &insn);
+        }
+    }
+
+    for (kind = 0, total = 0; kind < MCS51_XREF_KINDS; ++kind)
+        total += build.nr_refs[kind];
+
+    if (!(xref->refs = malloc((total ? total : 1) * sizeof(*xref->refs))))
+        err(-1, "xref alloc err");
+
+    for (kind = 0, total = 0; kind < MCS51_XREF_KINDS; ++kind) {
+        qsort(build.refs[kind], build.nr_refs[kind], sizeof(*xref->refs), xref_cmp);
+        if (build.nr_refs[kind])
+            memcpy(xref->refs + total, build.refs[kind],
+                   build.nr_refs[kind] * sizeof(*xref->refs));
+        xref->first[kind] = total;
+        total += build.nr_refs[kind];
+        free(build.refs[kind]);
+    }
+
+    xref->first[MCS51_XREF_KINDS] = total;
+    xref->owned = true;
+}
+
+/**
+ * mcs51_xref_load - use an index file written by mcs51_xref_save.
+ * @xref: tables to set up.
+ * @data: file contents, kept in use until mcs51_xref_release.
+ * @size: size of @data.
+ *
+ * Returns 0, or -EINVAL when @data is not a valid index.
+ */
+int mcs51_xref_load(struct mcs51_xref *xref, const void *data, size_t size)
+{
+    const struct mcs51_xref_head *head = data;
+    unsigned int kind;
+    uint64_t first;
+
+    memset(xref, 0, sizeof(*xref));
+
+    if (size < sizeof(*head) || memcmp(head->magic, MCS51_XREF_MAGIC, sizeof(head->magic)) ||
+        le32toh(head->version) != MCS51_XREF_VERSION ||
+        le32toh(head->kinds) != MCS51_XREF_KINDS)
+        return -EINVAL;
+
+    for (kind = 0; kind <= MCS51_XREF_KINDS; ++kind) {
+        first = le64toh(head->first[kind]);
+        if ((kind && first < xref->first[kind - 1]) ||
+            first > (size - sizeof(*head)) / sizeof(*xref->refs))
+            return -EINVAL;
+        xref->first[kind] = first;
+    }
+
+    xref->refs = (struct mcs51_xref_entry *)(head + 1);
+    return 0;
+}
+
+/**
+ * mcs51_xref_save - write the tables as an index file.
+ * @xref: tables to write.
+ * @emit: emitter to write to.
+ *
+ * The file is the header followed by the entries exactly as they are
+ * held in memory, so it can be mapped and searched as is.
+ */
+void mcs51_xref_save(const struct mcs51_xref *xref, struct mcs51_emit *emit)
+{
+    struct mcs51_xref_head head = { };
+    size_t index, count, total;
+    unsigned int kind;
+
+    memcpy(head.magic, MCS51_XREF_MAGIC, sizeof(head.magic));
+    head.version = htole32(MCS51_XREF_VERSION);
+    head.kinds = htole32(MCS51_XREF_KINDS);
+    for (kind = 0; kind <= MCS51_XREF_KINDS; ++kind)
+        head.first[kind] = htole64(xref->first[kind]);
+
+    memcpy(mcs51_emit_reserve(emit, sizeof(head)), &head, sizeof(head));
+    emit->len += sizeof(head);
+
+    total = xref->first[MCS51_XREF_KINDS];
+    for (index = 0; index < total; index += count) {
+        count = total - index < XREF_CHUNK ? total - index : XREF_CHUNK;
+        memcpy(mcs51_emit_reserve(emit, count * sizeof(*xref->refs)),
+               xref->refs + index, count * sizeof(*xref->refs));
+        emit->len += count * sizeof(*xref->refs);
+    }
+}
+
+void mcs51_xref_release(struct mcs51_xref *xref)
+{
+    if (xref->owned)
+        free(xref->refs);
+    xref->refs = NULL;
+}
+
+/**
+ * mcs51_xref_find - look up the references to an address.
+ * @xref: tables to search.
+ * @kind: kind of reference.
+ * @to: referenced address.
+ * @count: filled with the number of references.
+ *
+ * Returns the first matching entry, the others follow it in source
+ * address order.
+ */
+const struct mcs51_xref_entry *mcs51_xref_find(const struct mcs51_xref *xref,
+                                               enum mcs51_xref_kind kind,
+                                               uint32_t to, size_t *count)
+{
+    size_t low = xref->first[kind], high = xref->first[kind + 1], mid, start;
+
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (xref_to(&xref->refs[mid]) < to)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    start = low;
+    for (high = xref->first[kind + 1]; low < high;) {
+        mid = (low + high) / 2;
+        if (xref_to(&xref->refs[mid]) <= to)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    *count = low - start;
+    return &xref->refs[start];
+}
+
+/**
+ * mcs51_xref_kind - parse the name of a reference kind.
+ * @name: "call", "jump", "direct", "bit" or "dptr".
+ *
+ * Returns the kind, or MCS51_XREF_KINDS for an unknown name.
+ */
+enum mcs51_xref_kind mcs51_xref_kind(const char *name)
+{
+    unsigned int kind;
+
+    for (kind = 0; kind < MCS51_XREF_KINDS; ++kind)
+        if (!strcmp(name, xref_kind_name[kind]))
+            break;
+
+    return kind;
+}
+
+static int xref_addr_cmp(const void *pa, const void *pb)
+{
+    uint32_t a = *(const uint32_t *)pa, b = *(const uint32_t *)pb;
+    return a < b ? -1 : a > b;
+}
+
+static int xref_edge_cmp(const void *pa, const void *pb)
+{
+    const uint32_t *a = pa, *b = pb;
+
+    if (a[0] != b[0])
+        return a[0] < b[0] ? -1 : 1;
+    return a[1] < b[1] ? -1 : a[1] > b[1];
+}
+
+/*
+ * Call graph nodes are the reset vector and every call target. A call
+ * site belongs to the closest node at or below it.
+ */
+static size_t xref_owner(const uint32_t *nodes, size_t nr_nodes, uint32_t addr)
+{
+    size_t low = 0, high = nr_nodes, mid;
+
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (nodes[mid] <= addr)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low ? low - 1 : 0;
+}
+
+/**
+ * mcs51_xref_callgraph - write the call graph.
+ * @xref: tables to take calls from.
+ * @emit: emitter to write to.
+ * @json: write JSON instead of Graphviz DOT.
+ *
+ * Routines are named by their L_xxxx label. Code before the first
+ * routine is attributed to the reset vector.
+ */
+void mcs51_xref_callgraph(const struct mcs51_xref *xref, struct mcs51_emit *emit,
+                          bool json)
+{
+    const struct mcs51_xref_entry *calls = &xref->refs[xref->first[MCS51_XREF_CALL]];
+    size_t nr_calls = xref->first[MCS51_XREF_CALL + 1] - xref->first[MCS51_XREF_CALL];
+    size_t nr_nodes = 0, nr_edges = 0, index;
+    uint32_t *nodes, (*edges)[2];
+    char *buf, *walk;
+
+    nodes = malloc((nr_calls + 1) * sizeof(*nodes));
+    edges = malloc((nr_calls ? nr_calls : 1) * sizeof(*edges));
+    if (!nodes || !edges)
+        err(-1, "callgraph alloc err");
+
+    /* calls are sorted by target, so unique targets come out in order */
+    nodes[nr_nodes++] = XREF_RESET;
+    for (index = 0; index < nr_calls; ++index)
+        if (xref_to(&calls[index]) != nodes[nr_nodes - 1])
+            nodes[nr_nodes++] = xref_to(&calls[index]);
+    qsort(nodes, nr_nodes, sizeof(*nodes), xref_addr_cmp);
+
+    for (index = 0; index < nr_calls; ++index) {
+        edges[nr_edges][0] = nodes[xref_owner(nodes, nr_nodes, xref_from(&calls[index]))];
+        edges[nr_edges][1] = xref_to(&calls[index]);
+        nr_edges++;
+    }
+    qsort(edges, nr_edges, sizeof(*edges), xref_edge_cmp);
+
+    buf = mcs51_emit_reserve(emit, 32);
+    walk = buf + sprintf(buf, json ? "{\"nodes\":[" : "digraph calls {\n");
+    emit->len += walk - buf;
+
+    for (index = 0; index < nr_nodes; ++index) {
+        walk = buf = mcs51_emit_reserve(emit, 64);
+        if (json) {
+            walk += sprintf(walk, "%s{\"addr\":%u,\"label\":\"", index ? "," : "",
+                            nodes[index]);
+            walk += mcs51_format_label(walk, nodes[index]);
+            walk += sprintf(walk, "\"}");
+        } else {
+            *walk++ = '\t';
+            walk += mcs51_format_label(walk, nodes[index]);
+            walk += sprintf(walk, ";\n");
+        }
+        emit->len += walk - buf;
+    }
+
+    buf = mcs51_emit_reserve(emit, 32);
+    emit->len += sprintf(buf, json ? "],\"edges\":[" : "");
+
+    for (index = 0; index < nr_edges; ++index) {
+        if (index && !xref_edge_cmp(edges[index], edges[index - 1]))
+            continue;
+        walk = buf = mcs51_emit_reserve(emit, 64);
+        if (json) {
+            walk += sprintf(walk, "%s[%u,%u]", index ? "," : "",
+                            edges[index][0], edges[index][1]);
+        } else {
+            *walk++ = '\t';
+            walk += mcs51_format_label(walk, edges[index][0]);
+            walk += sprintf(walk, " -> ");
+            walk += mcs51_format_label(walk, edges[index][1]);
+            walk += sprintf(walk, ";\n");
+        }
+        emit->len += walk - buf;
+    }
+
+    buf = mcs51_emit_reserve(emit, 32);
+    emit->len += sprintf(buf, json ? "]}\n" : "}\n");
+
+    free(edges);
+    free(nodes);
+}